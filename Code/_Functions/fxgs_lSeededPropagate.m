@@ -11,10 +11,15 @@ function [L, D] = fxgs_lSeededPropagate(I, L, params)
     % Thr:          Intensity threshold for propagated objects
     % Power:        Apply power law to intensity image prior to processing
     % AnalyzeCC:    Set to 0 for input label mask is passed, 1 for binary mask
+    % NThreads:     Optional, number of threads (connected components of the mask propagated in parallel, same output), default 1
 
     Thr = params.Thr;
     Power = params.Power;
     AnalyzeCC = params.AnalyzeCC;
+    NThreads = 1;
+    if isfield(params,'NThreads')
+        NThreads = params.NThreads;
+    end
     
     if ~isempty(I)
     
@@ -26,9 +31,15 @@ function [L, D] = fxgs_lSeededPropagate(I, L, params)
        
         M = (I>Thr);
         if Power ~= 1 
-            [L D] = PropagateRegIntegrate(L,(double(I)).^Power, M);
+            I = (double(I)).^Power;
+        else
+            I = double(I);
+        end
+        %% NThreads is only passed when set: the bundled binary takes 3 inputs
+        if isfield(params,'NThreads')
+            [L D] = PropagateRegIntegrate(L,I,M,NThreads);
         else
-            [L D] = PropagateRegIntegrate(L,double(I),M);
+            [L D] = PropagateRegIntegrate(L,I,M);
         end
         
         L = uint16(L);
@@ -13,6 +13,12 @@ function [L] = fxgs_lSeededPropagate3D(I,L,M,params)
     % AnalyzeCC:            Set to 0 for input label mask is passed, 1 for binary mask
     % MinVol:               Minimum object volume (voxels)
     % BinaryOut:            Force output to be binary (touching particles with different labels are split apart)
+    % QueueEngine:          Optional, propagation queue: 0 binary heap (default), 1 bucket queue (same output, faster on large stacks)
+    % NThreads:             Optional, number of threads (same output), default 1
+    % ParallelMode:         Optional, 0: stack split in z slabs (default), 1: connected components of the mask propagated in parallel
+    % RegIntegrate:         Optional, set to 1 to use 3x3x3 patch differences (PropagateRegIntegrate3D), default 0
+    % Connectivity:         Optional, RegIntegrate connectivity (6, 18 or 26), default 26
+    % ZRatio:               Optional, RegIntegrate z / xy voxel size ratio, default 1
     
     %% Parameters
     BckSeedLvl = params.BckSeedLvl;
@@ -21,6 +27,30 @@ function [L] = fxgs_lSeededPropagate3D(I,L,M,params)
     AnalyzeCC = params.AnalyzeCC;
     MinVol = params.MinVol;
     BinaryOut = params.BinaryOut;
+    QueueEngine = 0;
+    if isfield(params,'QueueEngine')
+        QueueEngine = params.QueueEngine;
+    end
+    NThreads = 1;
+    if isfield(params,'NThreads')
+        NThreads = params.NThreads;
+    end
+    ParallelMode = 0;
+    if isfield(params,'ParallelMode')
+        ParallelMode = params.ParallelMode;
+    end
+    RegIntegrate = 0;
+    if isfield(params,'RegIntegrate')
+        RegIntegrate = params.RegIntegrate;
+    end
+    Connectivity = 26;
+    if isfield(params,'Connectivity')
+        Connectivity = params.Connectivity;
+    end
+    ZRatio = 1;
+    if isfield(params,'ZRatio')
+        ZRatio = params.ZRatio;
+    end
     
     if ~isempty(I)
     
@@ -33,32 +63,48 @@ function [L] = fxgs_lSeededPropagate3D(I,L,M,params)
         
         %% Optionally analyze CC
 		if AnalyzeCC
-            L = single(bwlabeln(L,6));
+            L = bwlabeln(L,6);
+        end
+        
+        %% Labels are propagated natively as uint16 (uint32 if too many labels)
+        if max(L(:)) < 65535
+            L = uint16(L);
         else
-            L = single(L);
+            L = uint32(L);
         end
         
         %% Optionally add background seeds
         if BckSeedLvl > 0
             L(L>0) = L(L>0)+1;
-            L = single((I < BckSeedLvl).*(L==0)) + L;
+            L = cast((I < BckSeedLvl)&(L==0),class(L)) + L;
             M = logical(ones(size(L)));
         end
         
         %% Set mask borders to 0 since no image border check is performed in Propgate_3D
         M(1,:,:) = 0;M(end,:,:) = 0;M(:,1,:) = 0;M(:,end,:) = 0;M(:,:,1) = 0;M(:,:,end) = 0;
    
-        %% Propagate
+        %% Propagate (uint8, uint16, single and double intensity images are read natively)
         if Power ~= 1
-            L = uint16(Propagate_3D_single(L,(I).^Power,logical(M),single(size(I,3))));
+            I = single(I).^Power;
+        end
+        if RegIntegrate == 1
+            L = PropagateRegIntegrate3D(L,I,logical(M),Connectivity,ZRatio);
+        elseif (QueueEngine == 0)&&(NThreads == 1)&&(ParallelMode == 0)
+            %% Default engine: native label and image classes, single copies only for the
+            %% bundled binary (4 arguments, rejects labels and image that are not single)
+            try
+                L = Propagate_3D_single(L,I,logical(M),single(size(I,3)));
+            catch
+                L = cast(Propagate_3D_single(single(L),single(I),logical(M),single(size(I,3))),class(L));
+            end
         else
-            L = uint16(Propagate_3D_single(L,I,logical(M),single(size(I,3))));
+            L = Propagate_3D_single(L,I,logical(M),single(size(I,3)),QueueEngine,0,NThreads,ParallelMode);
         end
         L = reshape(L,size(I));
         
         %% Remove small particles
         if MinVol>0
-            L = L.*uint16(bwareaopen(L>0, MinVol));
+            L = L.*cast(bwareaopen(L>0, MinVol),class(L));
         end
         
         %% Account for background seeds
@@ -30,7 +30,11 @@ function O = fxk_kSklLbl3D(O, params)
     if ~isempty(O)
         
         %% Skeleton analysis (note: isolated loops are ignored)
-        [~, node, link] = Skel2Graph3D((O>=200),0);
+        if exist('skeletongraph','file')==3
+            [~, node, link] = skeletongraph((O>=200),0);
+        else
+            [~, node, link] = Skel2Graph3D((O>=200),0);
+        end
         
         %% Remove mask
         if SklLbl > 0
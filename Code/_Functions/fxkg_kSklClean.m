@@ -31,7 +31,11 @@ function [M] = fxkg_kSklClean(M, I, params)
             
             %% Remove small branches with endpoints
             if MinBrchLgth > 0
-                D = bwdistgeodesic(skl,sklbr);
+                if exist('geodesicdistance','file')==3
+                    D = geodesicdistance(skl,sklbr,[],[],'chessboard');
+                else
+                    D = bwdistgeodesic(skl,sklbr);
+                end
                 Msk = (D <= MinBrchLgth)&(D > 1);
                 Rem = imreconstruct(sklep, Msk,8);
                 skl = (skl-Rem);
@@ -11,10 +11,20 @@ function [It] = fxm_kSkl3D(M, params)
     % ClosePreRad:      Morphological closing radius (preprocessing, pix)      
     % Min2DHolesArea:   Maximum volume for hole closing (preprocessing, vox)
     % MinVol:           Minimum skeletons volume (vox)
+    % ThinningMode:     Optional, 0: sequential isthmus thinning (default), 1: parallel subfield based isthmus thinning
+    % NThreads:         Optional, number of threads of the parallel thinning, default 1
 
     PreCloseRad = params.PreCloseRad;
     Min2DHolesArea = params.Min2DHolesArea;
     MinVol = params.MinVol;
+    ThinningMode = 0;
+    if isfield(params,'ThinningMode')
+        ThinningMode = params.ThinningMode;
+    end
+    NThreads = 1;
+    if isfield(params,'NThreads')
+        NThreads = params.NThreads;
+    end
     
     if ~isempty(M)
         
@@ -45,8 +55,8 @@ function [It] = fxm_kSkl3D(M, params)
         M(1,:,:) = 0;M(end,:,:) = 0;M(:,1,:) = 0;M(:,end,:) = 0;M(:,:,1) = 0;M(:,:,end) = 0;
 
         %% Thinning
-        cd Code/_Utils/isthmus_thinning;  % Required since function reads tables locally
-        It = isthmusthinning(M);
+        cd Code/_Utils/isthmus_thinning;  % Required since the bundled binary reads tables locally
+        It = isthmusthinning(M,ThinningMode,NThreads);
         cd(currentpath);
         
         %% Remove small isolated skeletons
@@ -31,7 +31,11 @@ function [T] = fxm_kSklGeod3D(T, params)
         end
 
         %% Geodesic distance map from seeds + discretize
-        D = single(bwdistgeodesic(T>0,Seeds,'quasi-euclidean'));
+        if exist('geodesicdistance','file')==3
+            D = geodesicdistance(T>0,Seeds,[],[],'quasi-euclidean');
+        else
+            D = single(bwdistgeodesic(T>0,Seeds,'quasi-euclidean'));
+        end
         D(isinf(D)) = NaN;
         D = round(D/Step);
         
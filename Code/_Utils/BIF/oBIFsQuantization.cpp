@@ -1,43 +1,146 @@
 #include "mex.h"
 #include <math.h>
+#include <vector>
+#include <algorithm>
 //nlhs	Number of expected mxArrays (Left Hand Side)
 //plhs	Array of pointers to expected outputs
 //nrhs	Number of inputs (Right Hand Side)
 //prhs	Array of pointers to input data. The input data is read-only and should not be altered by your mexFunction .
 
+// Output = oBIFsQuantization(Image, Directions, outputX, outputY)
+// Index (1-based, uint8) of the direction closest to each pixel of Image (single or double),
+// the first one in Directions on ties. outputX, outputY (optional): size of Output, default size
+// of Image.
+// The directions are sorted once: a pixel is then compared to the two sorted directions around
+// it, found arithmetically if the directions are uniformly spaced (e.g. every 45 degrees) or by
+// binary search otherwise. The distances are computed as in the plain scan, so the results are
+// the same. The pixels are processed in parallel (OpenMP).
+
+struct Direction
+{
+	double angle;
+	int index;
+	bool operator<(const Direction &d) const { return (angle < d.angle)||((angle == d.angle)&&(index < d.index)); }
+};
+
+// Plain scan of all the directions (directions with NaN or Inf)
+static int scan_closest(const double *dirs, int ndirs, double x)
+{
+	double closest = dirs[0];
+	int best = 1;
+	for(int i=0;i<ndirs;i++)
+		if(fabs(dirs[i]-x) < fabs(closest-x)) { closest = dirs[i]; best = i+1; }
+	return best;
+}
+
+// Closest direction from the number of sorted directions <= x (p, an estimate is corrected)
+static int sorted_closest(const std::vector<Direction> &s, long p, double x)
+{
+	long n = (long)s.size(), lo, hi;
+	double dmin;
+	int best;
+
+	while((p > 0)&&(s[p-1].angle > x)) p--;
+	while((p < n)&&(s[p].angle <= x)) p++;
+
+	// Closest of the two directions around x, then all the directions at the same distance
+	// (rounding of the differences is monotonic: they are contiguous in the sorted order)
+	dmin = (p > 0) ? fabs(s[p-1].angle-x) : HUGE_VAL;
+	if((p < n)&&(fabs(s[p].angle-x) < dmin)) dmin = fabs(s[p].angle-x);
+	best = n+1;
+	for(lo=p-1;(lo >= 0)&&(fabs(s[lo].angle-x) == dmin);lo--) if(s[lo].index < best) best = s[lo].index;
+	for(hi=p;(hi < n)&&(fabs(s[hi].angle-x) == dmin);hi++) if(s[hi].index < best) best = s[hi].index;
+	return best;
+}
+
+template <typename T>
+static void quantize(const T *image, mwSignedIndex elements, const double *dirs, int ndirs, unsigned char *output)
+{
+	std::vector<Direction> s(ndirs);
+	bool finite = true, uniform;
+	double step = 0;
+	mwSignedIndex x;
+	int i;
+
+	for(i=0;i<ndirs;i++)
+	{
+		s[i].angle = dirs[i];
+		s[i].index = i+1;
+		if(!(fabs(dirs[i]) < HUGE_VAL)) finite = false;
+	}
+	if(!finite)
+	{
+		#pragma omp parallel for
+		for(x=0;x<elements;x++) output[x] = (unsigned char)scan_closest(dirs, ndirs, (double)image[x]);
+		return;
+	}
+	std::sort(s.begin(), s.end());
+
+	// Uniform spacing of the distinct directions
+	std::vector<double> u;
+	for(i=0;i<ndirs;i++) if((i == 0)||(s[i].angle != s[i-1].angle)) u.push_back(s[i].angle);
+	uniform = (u.size() > 1);
+	if(uniform) step = (u.back()-u[0])/(u.size()-1);
+	for(i=1;uniform&&(i<(int)u.size());i++) if(fabs(u[i]-u[0]-i*step) > 1e-9*step) uniform = false;
+
+	#pragma omp parallel for
+	for(x=0;x<elements;x++)
+	{
+		double v = (double)image[x], b;
+		long p = 0, lo, hi, mid;
+		if(v != v) { output[x] = 1; continue; }
+		if(uniform)
+		{
+			// Number of directions <= v from the bin, duplicates included by the correction
+			b = floor((v-u[0])/step)+1;
+			p = (b < 0) ? 0 : ((b > ndirs) ? ndirs : (long)b);
+		}
+		else
+		{
+			for(lo=0, hi=ndirs;lo<hi;)
+			{
+				mid = (lo+hi)/2;
+				if(s[mid].angle <= v) lo = mid+1; else hi = mid;
+			}
+			p = lo;
+		}
+		output[x] = (unsigned char)sorted_closest(s, p, v);
+	}
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
- int i, index, outputX, outputY;
- double *inputArray, *inputImage;
- double *output;
- double closest;
- int elements,nDirections;
+ mwSize outputX, outputY;
+ const double *inputArray;
+ unsigned char *output;
+ mwSignedIndex elements;
+ int nDirections;
+
+if((nrhs != 2)&&(nrhs != 4)) mexErrMsgTxt("Inputs: image, directions, optional output size.");
+if(!mxIsDouble(prhs[0])&&!mxIsSingle(prhs[0])) mexErrMsgTxt("The image must be single or double.");
+if(!mxIsDouble(prhs[1])) mexErrMsgTxt("The directions must be double.");
 
 // Get the input angle
-inputImage = mxGetPr(prhs[0]);
 inputArray = mxGetPr(prhs[1]);
-outputX = (int)mxGetPr(prhs[2])[0];
-outputY = (int)mxGetPr(prhs[3])[0];
+nDirections = (int)mxGetNumberOfElements(prhs[1]);
+if((nDirections < 1)||(nDirections > 255)) mexErrMsgTxt("1 to 255 directions are required.");
+elements = (mwSignedIndex)mxGetNumberOfElements(prhs[0]);
+if(nrhs == 4)
+{
+    outputX = (mwSize)mxGetScalar(prhs[2]);
+    outputY = (mwSize)mxGetScalar(prhs[3]);
+    if((mwSignedIndex)(outputX*outputY) != elements) mexErrMsgTxt("The output size does not match the image.");
+}
+else
+{
+    outputX = mxGetM(prhs[0]);
+    outputY = mxGetN(prhs[0]);
+}
 
 /* Create a pointer to the output data */
-plhs[0] = mxCreateDoubleMatrix(outputX, outputY,mxREAL);
-output = mxGetPr(plhs[0]);
-elements=mxGetNumberOfElements(prhs[0]);
-nDirections=mxGetNumberOfElements(prhs[1]);
-
-
-for ( int x = 0; x < elements; x++) {
-    closest = inputArray[0];
-    output[x] = 1;
-    
-    for ( int i = 0; i < nDirections; ++i ) {
-        if ( fabs( inputArray[ i ] - inputImage[x] ) < fabs( closest - inputImage[x] ) ) 
-        {
-          closest = inputArray[i];
-          output[x] = i+1;
-        }
-    }
-}
+plhs[0] = mxCreateNumericMatrix(outputX, outputY, mxUINT8_CLASS, mxREAL);
+output = (unsigned char *)mxGetData(plhs[0]);
 
+if(mxIsSingle(prhs[0])) quantize((const float *)mxGetData(prhs[0]), elements, inputArray, nDirections, output);
+else quantize(mxGetPr(prhs[0]), elements, inputArray, nDirections, output);
 }
-        
\ No newline at end of file
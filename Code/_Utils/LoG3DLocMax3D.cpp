@@ -0,0 +1,331 @@
+#include <math.h>
+#include "matrix.h"
+#include "mex.h"
+#include <cmath>
+#include <omp.h>
+#include "LocMax3D.h"
+
+// O = LoG3DLocMax3D(I, Sigmas, Radii, MinLoG, NrmLoG, MinDst, ListOut)
+//
+// Fused 3D LoG filter + local maxima detection (same steps as fxg_sLoG3DLocMax3D + LocMax3D_thr)
+// streamed plane by plane: the stack is never duplicated, only a few planes are kept in ring buffers:
+// - y-x Gaussian smoothed input planes (z kernel length)
+// - z smoothed planes (3, for the second derivatives)
+// - LoG planes and their y-x running max (2Rz+1, for the local maximum test)
+//
+// I:       3D stack (uint8, uint16, single or double, filtered in single precision)
+// Sigmas:  [Y X Z] sigmas of the Gaussian pre-filter (kernel length round(5*sigma), symmetric borders)
+// Radii:   [Ry Rx Rz] half sizes of the local maxima search box
+// MinLoG:  minimum LoG response
+// NrmLoG:  set to 1 if MinLoG is relative to the maximum LoG response
+// MinDst (optional): maxima closer than MinDst are replaced by their mid point (0: disabled)
+// ListOut (optional): set to 1 to return an N x 4 list [y x z response] (1-based) instead of the mask
+
+// x pass of the y-x running max: number of rows processed together
+#define TILE 64
+
+// fspecial('gauss',[round(5*sigma) 1],sigma), returns the imfilter kernel origin
+static int gauss_kernel(double sigma, vector<float> &h)
+{
+	int n = (int)floor(5*sigma+0.5);
+	if(n < 1)n = 1;
+	vector<double> hd(n);
+	double hmax = 0, hsum = 0;
+	for(int t=0;t<n;t++)
+	{
+		const double x = t-(n-1)/2.0;
+		hd[t] = (sigma > 0) ? exp(-x*x/(2*sigma*sigma)) : 1;
+		if(hd[t] > hmax)hmax = hd[t];
+	}
+	for(int t=0;t<n;t++)
+	{
+		if(hd[t] < mxGetEps()*hmax)hd[t] = 0;
+		hsum += hd[t];
+	}
+	h.resize(n);
+	for(int t=0;t<n;t++)h[t] = (float)(hd[t]/hsum);
+	return (n+1)/2-1;
+}
+
+// 'symmetric' border extension
+static inline long long reflect(long long i, long long n)
+{
+	while((i < 0)||(i >= n))
+	{
+		if(i < 0)i = -i-1;
+		if(i >= n)i = 2*n-i-1;
+	}
+	return i;
+}
+
+// y then x Gaussian filtering of one plane (tmp: one plane)
+template <typename T>
+static void smooth_plane_yx(const T *in, float *out, float *tmp, long long ny, long long nx,
+                            const vector<float> &hy, int cy, const vector<float> &hx, int cx)
+{
+	const int ly = hy.size();
+	const int lx = hx.size();
+
+	#pragma omp parallel for schedule(dynamic,16)
+	for(long long j=0;j<nx;j++)
+	{
+		const T *col = in+j*ny;
+		float *tcol = tmp+j*ny;
+		for(long long i=0;i<ny;i++)
+		{
+			float acc = 0;
+			if((i-cy >= 0)&&(i-cy+ly <= ny))
+			{
+				const T *src = col+i-cy;
+				for(int t=0;t<ly;t++)acc += hy[t]*(float)src[t];
+			}
+			else
+			{
+				for(int t=0;t<ly;t++)acc += hy[t]*(float)col[reflect(i+t-cy,ny)];
+			}
+			tcol[i] = acc;
+		}
+	}
+
+	#pragma omp parallel for schedule(dynamic,16)
+	for(long long j=0;j<nx;j++)
+	{
+		float *ocol = out+j*ny;
+		for(long long i=0;i<ny;i++)ocol[i] = 0;
+		for(int t=0;t<lx;t++)
+		{
+			const float w = hx[t];
+			const float *tcol = tmp+reflect(j+t-cx,nx)*ny;
+			for(long long i=0;i<ny;i++)ocol[i] += w*tcol[i];
+		}
+	}
+}
+
+// Streaming state: ring buffers of planes
+struct LoGStream {
+	const void *im_in;
+	mxClassID ClassID;
+	long long ny, nx, nz, nxy;
+	vector<float> hy, hx, hz;
+	int cy, cx, cz;
+	long long nP;
+	vector<float> P, F, tmp;
+	vector<long long> tagP, tagF;
+
+	// y-x smoothed input plane idx
+	const float *plane_yx(long long idx)
+	{
+		const long long slot = idx%nP;
+		if(tagP[slot] != idx)
+		{
+			float *out = &P[slot*nxy];
+			switch(ClassID)
+			{
+				case mxUINT8_CLASS:
+					smooth_plane_yx((const unsigned char *)im_in+idx*nxy, out, &tmp[0], ny, nx, hy, cy, hx, cx);
+					break;
+				case mxUINT16_CLASS:
+					smooth_plane_yx((const unsigned short *)im_in+idx*nxy, out, &tmp[0], ny, nx, hy, cy, hx, cx);
+					break;
+				case mxSINGLE_CLASS:
+					smooth_plane_yx((const float *)im_in+idx*nxy, out, &tmp[0], ny, nx, hy, cy, hx, cx);
+					break;
+				default:
+					smooth_plane_yx((const double *)im_in+idx*nxy, out, &tmp[0], ny, nx, hy, cy, hx, cx);
+					break;
+			}
+			tagP[slot] = idx;
+		}
+		return &P[slot*nxy];
+	}
+
+	// Fully smoothed plane m (the planes of the z window are all resident in the P ring)
+	const float *plane_smooth(long long m)
+	{
+		const long long slot = m%3;
+		if(tagF[slot] != m)
+		{
+			const int lz = hz.size();
+			vector<const float *> src(lz);
+			for(int t=0;t<lz;t++)src[t] = plane_yx(reflect(m+t-cz,nz));
+			float *dst = &F[slot*nxy];
+			#pragma omp parallel for schedule(dynamic,16)
+			for(long long j=0;j<nx;j++)
+			{
+				float *d = dst+j*ny;
+				for(long long i=0;i<ny;i++)d[i] = 0;
+				for(int t=0;t<lz;t++)
+				{
+					const float w = hz[t];
+					const float *s = src[t]+j*ny;
+					for(long long i=0;i<ny;i++)d[i] += w*s[i];
+				}
+			}
+			tagF[slot] = m;
+		}
+		return &F[slot*nxy];
+	}
+};
+
+// -(d2/dy2 + d2/dx2 + d2/dz2) with diff(.,2,dim) + 'post' zero padding (as fxg_sLoG3DLocMax3D)
+static float log_plane(LoGStream &st, long long k, float *L)
+{
+	const long long ny = st.ny, nx = st.nx;
+	const float *F0 = st.plane_smooth(k);
+	const float *F1 = (k+1 < st.nz) ? st.plane_smooth(k+1) : NULL;
+	const float *F2 = (k+2 < st.nz) ? st.plane_smooth(k+2) : NULL;
+	vector<float> tmax(omp_get_max_threads(), -INFINITY);
+
+	#pragma omp parallel for schedule(dynamic,16)
+	for(long long j=0;j<nx;j++)
+	{
+		float vmax = -INFINITY;
+		for(long long i=0;i<ny;i++)
+		{
+			const long long ind = i+j*ny;
+			float v = 0;
+			if(i < ny-2)v = -((F0[ind+2]-F0[ind+1])-(F0[ind+1]-F0[ind]));
+			if(j < nx-2)v = v-((F0[ind+2*ny]-F0[ind+ny])-(F0[ind+ny]-F0[ind]));
+			if(F2 != NULL)v = v-((F2[ind]-F1[ind])-(F1[ind]-F0[ind]));
+			L[ind] = v;
+			if(v > vmax)vmax = v;
+		}
+		if(vmax > tmax[omp_get_thread_num()])tmax[omp_get_thread_num()] = vmax;
+	}
+
+	float pmax = -INFINITY;
+	for(size_t t=0;t<tmax.size();t++)if(tmax[t] > pmax)pmax = tmax[t];
+	return pmax;
+}
+
+// (max,count) of the y-x windows of a LoG plane
+static void runmax_plane(const float *L, long long ny, long long nx, int Ry, int Rx,
+                         float *ymax, unsigned char *ycnt, float *xymax, unsigned char *xycnt,
+                         vector<RunMaxScratch<float> *> &scratch)
+{
+	#pragma omp parallel for schedule(dynamic,16)
+	for(long long j=0;j<nx;j++)runmax_plane_y(L, ny, j, j+1, Ry, ymax, ycnt, *scratch[omp_get_thread_num()]);
+
+	const long long ntiles = (ny+TILE-1)/TILE;
+	#pragma omp parallel for schedule(dynamic)
+	for(long long t=0;t<ntiles;t++)
+	{
+		const long long i0 = t*TILE;
+		const long long i1 = (i0+TILE < ny) ? i0+TILE : ny;
+		runmax_plane_x(ymax, ycnt, ny, nx, i0, i1, Rx, xymax, xycnt, *scratch[omp_get_thread_num()]);
+	}
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+                  int nrhs, const mxArray*prhs[] )
+{
+    // Check for proper number of arguments
+    if ((nrhs < 5)||(nrhs > 7))
+    {
+        mexErrMsgTxt("5 to 7 input arguments expected.");
+    }
+    const mxClassID ClassID = mxGetClassID(prhs[0]);
+    if ((ClassID != mxUINT8_CLASS)&&(ClassID != mxUINT16_CLASS)&&(ClassID != mxSINGLE_CLASS)&&(ClassID != mxDOUBLE_CLASS))
+    {
+        mexErrMsgTxt("First argument must be a uint8, uint16, single or double array.");
+    }
+    if ((mxGetNumberOfElements(prhs[1]) != 3)||(mxGetNumberOfElements(prhs[2]) != 3))
+    {
+        mexErrMsgTxt("Sigmas and Radii must have 3 elements.");
+    }
+	const void *im_in = mxGetData(prhs[0]);
+	const mwSize nDim = mxGetNumberOfDimensions(prhs[0]);
+	const mwSize *pDims = mxGetDimensions(prhs[0]);
+	const double *Sigmas = mxGetPr(prhs[1]);
+	const double *Radii = mxGetPr(prhs[2]);
+	const double MinLoG = mxGetScalar(prhs[3]);
+	const int NrmLoG = (int)mxGetScalar(prhs[4]);
+	double MinDst = 0;
+	if(nrhs > 5)MinDst = mxGetScalar(prhs[5]);
+	int ListOut = 0;
+	if(nrhs > 6)ListOut = (int)mxGetScalar(prhs[6]);
+	const int Ry = (int)Radii[0];
+	const int Rx = (int)Radii[1];
+	const int Rz = (int)Radii[2];
+
+	LoGStream st;
+	st.im_in = im_in;
+	st.ClassID = ClassID;
+	st.ny = pDims[0];
+	st.nx = (nDim > 1) ? pDims[1] : 1;
+	st.nz = (nDim > 2) ? pDims[2] : 1;
+	st.nxy = st.ny*st.nx;
+	st.cy = gauss_kernel(Sigmas[0], st.hy);
+	st.cx = gauss_kernel(Sigmas[1], st.hx);
+	st.cz = gauss_kernel(Sigmas[2], st.hz);
+	st.nP = ((long long)st.hz.size() < st.nz) ? (long long)st.hz.size() : st.nz;
+	st.P.resize(st.nP*st.nxy);
+	st.F.resize(3*st.nxy);
+	st.tmp.resize(st.nxy);
+	st.tagP.assign(st.nP,-1);
+	st.tagF.assign(3,-1);
+	const long long ny = st.ny, nx = st.nx, nz = st.nz, nxy = st.nxy;
+
+	// LoG planes and their y-x (max,count) windows for the 2Rz+1 planes of the z window
+	const long long nW = 2*Rz+1;
+	vector<float> L(nW*nxy), xymax(nW*nxy), ymax(nxy);
+	vector<unsigned char> xycnt(nW*nxy), ycnt(nxy);
+	vector<RunMaxScratch<float> *> scratch(omp_get_max_threads());
+	const size_t slen = ((size_t)nx*TILE > (size_t)ny) ? (size_t)nx*TILE : (size_t)ny;
+	for(size_t t=0;t<scratch.size();t++)scratch[t] = new RunMaxScratch<float>(ny, slen);
+
+	// Detection level (if relative, candidates are filtered once the maximum LoG is known)
+	float THR = (float)MinLoG;
+	if(NrmLoG > 0)THR = (MinLoG >= 0) ? 0 : -INFINITY;
+	float LoGmax = -INFINITY;
+
+	LocalMaxLists found(omp_get_max_threads());
+	const bool fits = (ny >= 2*Ry+2)&&(nx >= 2*Rx+2)&&(nz >= 2*Rz+2);
+	for(long long kl=0;kl<nz;kl++)
+	{
+		const long long wl = kl%nW;
+		const float pmax = log_plane(st, kl, &L[wl*nxy]);
+		if(pmax > LoGmax)LoGmax = pmax;
+		if(!fits)continue;
+		runmax_plane(&L[wl*nxy], ny, nx, Ry, Rx, &ymax[0], &ycnt[0], &xymax[wl*nxy], &xycnt[wl*nxy], scratch);
+
+		// Plane kd has its full z window
+		const long long kd = kl-Rz;
+		if((kd < Rz)||(kd >= nz-Rz-1))continue;
+		const float *Ld = &L[(kd%nW)*nxy];
+		#pragma omp parallel for schedule(dynamic,16)
+		for(long long j=Rx;j<nx-Rx-1;j++)
+		{
+			for(long long i=Ry;i<ny-Ry-1;i++)
+			{
+				const long long ind = i+j*ny;
+				const float val = Ld[ind];
+				if(!(val >= THR))continue;
+				float m = xymax[((kd-Rz)%nW)*nxy+ind];
+				unsigned char c = xycnt[((kd-Rz)%nW)*nxy+ind];
+				for(long long kk=kd-Rz+1;kk<=kd+Rz;kk++)combine(m, c, xymax[(kk%nW)*nxy+ind], xycnt[(kk%nW)*nxy+ind]);
+				if((m == val)&&(c == 1))found[omp_get_thread_num()].push_back(LocalMax(ind+kd*nxy,val));
+			}
+		}
+	}
+	for(size_t t=0;t<scratch.size();t++)delete scratch[t];
+
+	// Gather maxima in linear index order
+	vector<LocalMax> pts;
+	locmax_gather(found, pts);
+
+	// Relative level
+	if(NrmLoG > 0)
+	{
+		const float Lvl = (float)(fabs(LoGmax)*MinLoG);
+		size_t n = 0;
+		for(size_t p=0;p<pts.size();p++)if(pts[p].val >= Lvl)pts[n++] = pts[p];
+		pts.erase(pts.begin()+n,pts.end());
+	}
+
+	// Merge close maxima (the LoG is not stored, mid points get the strongest response of their pair)
+	if(MinDst > 0)locmax_mergeclose(pts, (const float *)NULL, MinDst, ny, nx);
+
+	plhs[0] = locmax_output(pts, ListOut, nDim, pDims);
+    return;
+}
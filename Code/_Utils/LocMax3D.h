@@ -0,0 +1,278 @@
+// LocMax3D.h
+//
+// Local maxima helpers shared by LocMax3D_thr.cpp and LoG3DLocMax3D.cpp:
+// - separable (max,count) running max filter used to test the strict local maximum rule
+// - MinDst merging of close maxima
+// - mask / list outputs
+
+#ifndef LOCMAX3D_H
+#define LOCMAX3D_H
+
+#include <math.h>
+#include "matrix.h"
+#include "mex.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include <limits>
+using namespace std;
+
+// Detected maximum (linear index + response, stored as double whatever the input class)
+struct LocalMax {
+	size_t ind;
+	double val;
+	LocalMax(size_t i, double v) : ind(i), val(v) {}
+	bool operator<(const LocalMax &b) const { return ind < b.ind; }
+};
+
+typedef vector< vector<LocalMax> > LocalMaxLists;
+
+// Running maximum + number of occurrences of the maximum (saturated to 2), the pair
+// is what allows the strict tie rule of the box scan to be reproduced
+template <typename T>
+static inline void combine(T &m, unsigned char &c, T m2, unsigned char c2)
+{
+	if(m2 > m)
+	{
+		m = m2;
+		c = c2;
+	}
+	else if(m2 == m)c = 2;
+}
+
+// van Herk / Gil-Werman running max along a line of len positions, each position
+// holding lanes contiguous values (lanes are processed together so that the inner
+// loops stay contiguous). Only the centres [R, len-R-1] of the output are written.
+// g/gc and h/hc are scratch buffers of len*lanes elements.
+template <typename T>
+static void runmax_lanes(const T *vin, const unsigned char *cin, size_t stride_in,
+                         T *vout, unsigned char *cout, size_t stride_out,
+                         size_t len, size_t lanes, int R,
+                         T *g, unsigned char *gc, T *h, unsigned char *hc)
+{
+	const size_t w = 2*R+1;
+	if(len < w)return;
+
+	// Block prefix maxima
+	for(size_t p=0;p<len;p++)
+	{
+		const T *v = vin+p*stride_in;
+		const unsigned char *c = cin+p*stride_in;
+		T *gp = g+p*lanes;
+		unsigned char *gcp = gc+p*lanes;
+		if(p%w == 0)
+		{
+			for(size_t l=0;l<lanes;l++){gp[l] = v[l];gcp[l] = c[l];}
+		}
+		else
+		{
+			for(size_t l=0;l<lanes;l++){gp[l] = gp[l-lanes];gcp[l] = gcp[l-lanes];combine(gp[l],gcp[l],v[l],c[l]);}
+		}
+	}
+
+	// Block suffix maxima
+	for(size_t p=len;p-->0;)
+	{
+		const T *v = vin+p*stride_in;
+		const unsigned char *c = cin+p*stride_in;
+		T *hp = h+p*lanes;
+		unsigned char *hcp = hc+p*lanes;
+		if((p%w == w-1)||(p == len-1))
+		{
+			for(size_t l=0;l<lanes;l++){hp[l] = v[l];hcp[l] = c[l];}
+		}
+		else
+		{
+			for(size_t l=0;l<lanes;l++){hp[l] = hp[l+lanes];hcp[l] = hcp[l+lanes];combine(hp[l],hcp[l],v[l],c[l]);}
+		}
+	}
+
+	// Window [p-R,p+R] = suffix of one block + prefix of the next (disjoint), or a full block
+	for(size_t p=R;p<len-R;p++)
+	{
+		const size_t a = p-R;
+		const size_t b = p+R;
+		T *vo = vout+p*stride_out;
+		unsigned char *co = cout+p*stride_out;
+		if(a%w == 0)
+		{
+			for(size_t l=0;l<lanes;l++){vo[l] = g[b*lanes+l];co[l] = gc[b*lanes+l];}
+		}
+		else
+		{
+			for(size_t l=0;l<lanes;l++)
+			{
+				vo[l] = h[a*lanes+l];co[l] = hc[a*lanes+l];
+				combine(vo[l],co[l],g[b*lanes+l],gc[b*lanes+l]);
+			}
+		}
+	}
+}
+
+// Scratch buffers of the plane running max (one set per thread)
+template <typename T>
+struct RunMaxScratch {
+	vector<T> line, g, h;
+	vector<unsigned char> ones, gc, hc;
+	RunMaxScratch(size_t ny, size_t len_lanes) : line(ny), g(len_lanes), h(len_lanes), ones(ny,1), gc(len_lanes), hc(len_lanes) {}
+};
+
+// NaN never wins a comparison in the box scan: lowest value for the running max
+template <typename T>
+static inline T nan_to_low(T v)
+{
+	return (v == v) ? v : -numeric_limits<T>::infinity();
+}
+
+// y windows of the columns [j0,j1) of a plane
+template <typename T>
+static void runmax_plane_y(const T *plane, size_t ny, size_t j0, size_t j1, int Ry,
+                           T *ymax, unsigned char *ycnt, RunMaxScratch<T> &s)
+{
+	for(size_t j=j0;j<j1;j++)
+	{
+		const T *col = plane+j*ny;
+		for(size_t i=0;i<ny;i++)s.line[i] = nan_to_low(col[i]);
+		runmax_lanes(&s.line[0], &s.ones[0], 1, ymax+j*ny, ycnt+j*ny, 1, ny, 1, Ry, &s.g[0], &s.gc[0], &s.h[0], &s.hc[0]);
+	}
+}
+
+// x windows of the rows [i0,i1) of a plane of y windows (scratch sized nx*(i1-i0))
+template <typename T>
+static void runmax_plane_x(const T *ymax, const unsigned char *ycnt, size_t ny, size_t nx, size_t i0, size_t i1, int Rx,
+                           T *xymax, unsigned char *xycnt, RunMaxScratch<T> &s)
+{
+	runmax_lanes(ymax+i0, ycnt+i0, ny, xymax+i0, xycnt+i0, ny, nx, i1-i0, Rx, &s.g[0], &s.gc[0], &s.h[0], &s.hc[0]);
+}
+
+// MATLAB round of the mid point of two (1-based) coordinates, back to 0-based
+static inline size_t midcoord(long long a, long long b)
+{
+	return (size_t)floor((a+b+2)/2.0+0.5)-1;
+}
+
+// Replace pairs of maxima closer than MinDst by their mid point (same rule and order as the
+// former find / knnsearch loop of fxg_sLoG3DLocMax3D). Nearest neighbours are searched in a
+// uniform grid of MinDst cells, stored in a hash table (cell key -> chained point list).
+// The response of a mid point is read from im_in, or is the largest of the pair if im_in is NULL.
+template <typename T>
+static void locmax_mergeclose(vector<LocalMax> &pts, const T *im_in, double MinDst,
+                              size_t size_y, size_t size_x)
+{
+	const size_t size_xy = size_x*size_y;
+	const size_t N = pts.size();
+	if(N < 2)return;
+
+	vector<long long> py(N), px(N), pz(N);
+	for(size_t n=0;n<N;n++)
+	{
+		py[n] = pts[n].ind%size_y;
+		px[n] = (pts[n].ind/size_y)%size_x;
+		pz[n] = pts[n].ind/size_xy;
+	}
+
+	// Hash grid
+	const double cell = MinDst;
+	size_t tsize = 1;
+	while(tsize < 2*N)tsize <<= 1;
+	vector<long long> head(tsize,-1), next(N,-1);
+	vector<uint64_t> keys(tsize,0);
+	#define CELLKEY(cy,cx,cz) ((((uint64_t)(cz)&0x1FFFFF)<<42)|(((uint64_t)(cx)&0x1FFFFF)<<21)|((uint64_t)(cy)&0x1FFFFF))
+	#define CELLHASH(key) ((size_t)(((key)*0x9E3779B97F4A7C15ULL)>>20)&(tsize-1))
+	for(size_t n=N;n-->0;)
+	{
+		uint64_t key = CELLKEY((long long)floor(py[n]/cell),(long long)floor(px[n]/cell),(long long)floor(pz[n]/cell));
+		size_t h = CELLHASH(key);
+		while((head[h] >= 0)&&(keys[h] != key))h = (h+1)&(tsize-1);
+		keys[h] = key;
+		next[n] = head[h];
+		head[h] = n;
+	}
+
+	// Nearest other maximum closer than MinDst
+	vector<long long> nn(N,-1);
+	#pragma omp parallel for schedule(dynamic,256)
+	for(long long n=0;n<(long long)N;n++)
+	{
+		const long long cy = (long long)floor(py[n]/cell), cx = (long long)floor(px[n]/cell), cz = (long long)floor(pz[n]/cell);
+		double best = MinDst*MinDst;
+		for(long long dz=-1;dz<=1;dz++)
+			for(long long dx=-1;dx<=1;dx++)
+				for(long long dy=-1;dy<=1;dy++)
+				{
+					uint64_t key = CELLKEY(cy+dy,cx+dx,cz+dz);
+					size_t h = CELLHASH(key);
+					while((head[h] >= 0)&&(keys[h] != key))h = (h+1)&(tsize-1);
+					for(long long m=head[h];m>=0;m=next[m])
+					{
+						if(m == n)continue;
+						const double d2 = (double)((py[m]-py[n])*(py[m]-py[n])+(px[m]-px[n])*(px[m]-px[n])+(pz[m]-pz[n])*(pz[m]-pz[n]));
+						if((d2 < best)||((d2 == best)&&(nn[n] >= 0)&&(m < nn[n])))
+						{
+							best = d2;
+							nn[n] = m;
+						}
+					}
+				}
+	}
+	#undef CELLKEY
+	#undef CELLHASH
+
+	// Sequential merge (removed maxima and inserted mid points depend on the order)
+	unordered_map<size_t,double> kept;
+	kept.reserve(2*N);
+	for(size_t n=0;n<N;n++)kept[pts[n].ind] = pts[n].val;
+	for(size_t n=0;n<N;n++)
+	{
+		const long long m = nn[n];
+		if(m < 0)continue;
+		kept.erase(pts[n].ind);
+		kept.erase(pts[m].ind);
+		const size_t mid = midcoord(py[n],py[m])+midcoord(px[n],px[m])*size_y+midcoord(pz[n],pz[m])*size_xy;
+		kept[mid] = (im_in != NULL) ? (double)im_in[mid] : max(pts[n].val,pts[m].val);
+	}
+
+	pts.clear();
+	for(unordered_map<size_t,double>::const_iterator it=kept.begin();it!=kept.end();++it)pts.push_back(LocalMax(it->first,it->second));
+	sort(pts.begin(),pts.end());
+}
+
+// Gather the per-thread lists in linear index order
+static void locmax_gather(LocalMaxLists &found, vector<LocalMax> &pts)
+{
+	for(size_t t=0;t<found.size();t++)
+	{
+		pts.insert(pts.end(),found[t].begin(),found[t].end());
+		vector<LocalMax>().swap(found[t]);
+	}
+	sort(pts.begin(),pts.end());
+}
+
+// uint8 mask (200 at maxima) or N x 4 list [y x z response] (1-based coordinates)
+static mxArray *locmax_output(const vector<LocalMax> &pts, int ListOut, mwSize nDim, const mwSize *pDims)
+{
+	const size_t size_y = pDims[0];
+	const size_t size_xy = size_y*pDims[1];
+	if(ListOut == 1)
+	{
+		const size_t N = pts.size();
+		mxArray *list_out = mxCreateDoubleMatrix(N, 4, mxREAL);
+		double *ptr_list = mxGetPr(list_out);
+		for(size_t n=0;n<N;n++)
+		{
+			ptr_list[n] = (double)(pts[n].ind%size_y+1);
+			ptr_list[n+N] = (double)((pts[n].ind/size_y)%pDims[1]+1);
+			ptr_list[n+2*N] = (double)(pts[n].ind/size_xy+1);
+			ptr_list[n+3*N] = pts[n].val;
+		}
+		return list_out;
+	}
+	mxArray *im_out = mxCreateNumericArray(nDim, pDims, mxUINT8_CLASS, mxREAL);
+	unsigned char *ptr_out = (unsigned char *)mxGetData(im_out);
+	for(size_t n=0;n<pts.size();n++)ptr_out[pts[n].ind] = 200;
+	return im_out;
+}
+
+#endif
@@ -3,71 +3,186 @@
 #include "mex.h"
 #include <cmath>
 #include <omp.h>
+#include "LocMax3D.h"
 
-void mexFunction( int nlhs, mxArray *plhs[], 
-                  int nrhs, const mxArray*prhs[] )    
-{ 
-    // Check for proper number of arguments
-    if (nrhs != 5)
-    { 
-        mexErrMsgTxt("Exactly 5 input arguments expected."); 
-    } 
-	float *im_in = (float *)mxGetPr(prhs[0]);
-	const int nDim = mxGetNumberOfDimensions(prhs[0]);
-    const int *pDims = mxGetDimensions(prhs[0]);
-	float THR = (float)mxGetScalar(prhs[1]);
-	int Ry = (int)mxGetScalar(prhs[2]);
-	int Rx = (int)mxGetScalar(prhs[3]);
-	int Rz = (int)mxGetScalar(prhs[4]);
-	float val;
-	bool valid;
-	int ind, ind2, ind3;
-	int size_y = pDims[0];
-	int size_x = pDims[1];
-	int size_z = pDims[2];
-	int size_xy = size_x*size_y;
+// O = LocMax3D_thr(I, THR, Ry, Rx, Rz, Mode, MinDst, ListOut)
+//
+// Mark (200) the voxels of stack I (uint8, uint16, single or double) above THR that are strictly
+// greater than every other voxel of their (2Ry+1)x(2Rx+1)x(2Rz+1) box.
+//
+// Mode (optional):
+// 0: full box scan of every voxel above THR (default)
+// 1: separable running max filter (van Herk / Gil-Werman), cost independent of box size
+//
+// MinDst (optional): maxima closer than MinDst are replaced by their mid point (0: disabled)
+// ListOut (optional): set to 1 to return an N x 4 list [y x z response] (1-based) instead of the mask
 
-	// Allocate output array
-	mxArray *im_out = mxCreateNumericArray(nDim, pDims, mxUINT8_CLASS, mxREAL);
-    char *ptr_out = (char *)mxGetPr(im_out);
+template <typename T>
+static void locmax_boxscan(const T *im_in, LocalMaxLists &found, double THR, long long Ry, long long Rx, long long Rz,
+                           long long size_y, long long size_x, long long size_z)
+{
+	T val;
+	bool valid;
+	long long ind, ind2, ind3;
+	long long size_xy = size_x*size_y;
 
     // Main loop
     #pragma omp parallel for private(ind,val,ind2,ind3,valid)
-    for(int i=Ry;i<size_y-Ry-1;i++)
+    for(long long i=Ry;i<size_y-Ry-1;i++)
     {
-    	for(int j=Rx;j<size_x-Rx-1;j++)
+    	for(long long j=Rx;j<size_x-Rx-1;j++)
     		{
-    			for(int k=Rz;k<size_z-Rz-1;k++)
+    			for(long long k=Rz;k<size_z-Rz-1;k++)
     			{
     				ind = i+j*size_y+k*size_xy;
     				val = im_in[ind];
     				if(val >= THR)
     				{
     					valid = true;
-    					for(int ko=-Rz;ko<Rz+1;ko++)
+    					for(long long ko=-Rz;ko<Rz+1;ko++)
     					{
     						ind2 = ind+ko*size_xy;
-    						for(int jo=-Rx;jo<Rx+1;jo++)
+    						for(long long jo=-Rx;jo<Rx+1;jo++)
     						{
     							ind3 = ind2+jo*size_y;
-    							for(int io=-Ry;io<Ry+1;io++)
-    							{	
+    							for(long long io=-Ry;io<Ry+1;io++)
+    							{
 									if(im_in[ind3+io] >= val)
 									{
 										if(!((ko == 0)&&(jo == 0)&&(io == 0)))
 										{
 											valid = false;
-											io = Rx;jo=Ry;ko=Rz;
+											io = Ry;jo=Rx;ko=Rz;
 										}
 									}
     							}
     						}
     					}
-    					if(valid == true)ptr_out[ind] = 200;
+    					if(valid == true)found[omp_get_thread_num()].push_back(LocalMax(ind,(double)val));
     				}
     			}
-			}    
+			}
     }
-    plhs[0] = im_out;
+}
+
+template <typename T>
+static void locmax_runmax(const T *im_in, LocalMaxLists &found, double THR, long long Ry, long long Rx, long long Rz,
+                          long long size_y, long long size_x, long long size_z)
+{
+	const size_t ny = size_y;
+	const size_t size_xy = (size_t)size_x*size_y;
+	if((size_y < 2*Ry+2)||(size_x < 2*Rx+2)||(size_z < 2*Rz+2))return;
+
+	// (max,count) of the y-x windows of every plane
+	T *xymax = (T *)mxMalloc(size_xy*size_z*sizeof(T));
+	unsigned char *xycnt = (unsigned char *)mxMalloc(size_xy*size_z);
+
+	// Pass 1: y (contiguous) then x windows, plane by plane
+	#pragma omp parallel
+	{
+		RunMaxScratch<T> s(ny, size_xy);
+		vector<T> ymax(size_xy);
+		vector<unsigned char> ycnt(size_xy);
+
+		#pragma omp for schedule(dynamic)
+		for(long long k=0;k<size_z;k++)
+		{
+			runmax_plane_y(im_in+k*size_xy, ny, 0, size_x, Ry, &ymax[0], &ycnt[0], s);
+			runmax_plane_x(&ymax[0], &ycnt[0], ny, size_x, 0, ny, Rx, xymax+k*size_xy, xycnt+k*size_xy, s);
+		}
+	}
+
+	// Pass 2: z windows, one y-z slab per x position, then compare
+	#pragma omp parallel
+	{
+		const size_t nyz = ny*size_z;
+		vector<T> zmax(nyz), g(nyz), h(nyz);
+		vector<unsigned char> zcnt(nyz), gc(nyz), hc(nyz);
+
+		#pragma omp for schedule(dynamic)
+		for(long long j=Rx;j<size_x-Rx-1;j++)
+		{
+			runmax_lanes(xymax+j*ny, xycnt+j*ny, size_xy, &zmax[0], &zcnt[0], ny, size_z, ny, Rz, &g[0], &gc[0], &h[0], &hc[0]);
+			for(long long k=Rz;k<size_z-Rz-1;k++)
+			{
+				for(long long i=Ry;i<size_y-Ry-1;i++)
+				{
+					const size_t ind = i+j*ny+k*size_xy;
+					const T val = im_in[ind];
+					if((val >= THR)&&(zmax[i+k*ny] == val)&&(zcnt[i+k*ny] == 1))found[omp_get_thread_num()].push_back(LocalMax(ind,(double)val));
+				}
+			}
+		}
+	}
+
+	mxFree(xymax);
+	mxFree(xycnt);
+}
+
+template <typename T>
+static void locmax_run(const T *im_in, int Mode, double MinDst, LocalMaxLists &found, vector<LocalMax> &pts, double THR,
+                       long long Ry, long long Rx, long long Rz, long long size_y, long long size_x, long long size_z)
+{
+	// Detection (one list per thread)
+	if(Mode == 1)locmax_runmax(im_in, found, THR, Ry, Rx, Rz, size_y, size_x, size_z);
+	else locmax_boxscan(im_in, found, THR, Ry, Rx, Rz, size_y, size_x, size_z);
+
+	// Gather maxima in linear index order
+	locmax_gather(found, pts);
+
+	// Merge close maxima
+	if(MinDst > 0)locmax_mergeclose(pts, im_in, MinDst, size_y, size_x);
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+                  int nrhs, const mxArray*prhs[] )
+{
+    // Check for proper number of arguments
+    if ((nrhs < 5)||(nrhs > 8))
+    {
+        mexErrMsgTxt("5 to 8 input arguments expected.");
+    }
+	const mxClassID ClassID = mxGetClassID(prhs[0]);
+	if ((ClassID != mxUINT8_CLASS)&&(ClassID != mxUINT16_CLASS)&&(ClassID != mxSINGLE_CLASS)&&(ClassID != mxDOUBLE_CLASS))
+	{
+		mexErrMsgTxt("First argument must be a uint8, uint16, single or double array.");
+	}
+	const void *im_in = mxGetData(prhs[0]);
+	const mwSize nDim = mxGetNumberOfDimensions(prhs[0]);
+    const mwSize *pDims = mxGetDimensions(prhs[0]);
+	double THR = mxGetScalar(prhs[1]);
+	long long Ry = (long long)mxGetScalar(prhs[2]);
+	long long Rx = (long long)mxGetScalar(prhs[3]);
+	long long Rz = (long long)mxGetScalar(prhs[4]);
+	int Mode = 0;
+	if(nrhs > 5)Mode = (int)mxGetScalar(prhs[5]);
+	double MinDst = 0;
+	if(nrhs > 6)MinDst = mxGetScalar(prhs[6]);
+	int ListOut = 0;
+	if(nrhs > 7)ListOut = (int)mxGetScalar(prhs[7]);
+	long long size_y = pDims[0];
+	long long size_x = (nDim > 1) ? pDims[1] : 1;
+	long long size_z = (nDim > 2) ? pDims[2] : 1;
+
+	LocalMaxLists found(omp_get_max_threads());
+	vector<LocalMax> pts;
+	switch(ClassID)
+	{
+		case mxUINT8_CLASS:
+			locmax_run((const unsigned char *)im_in, Mode, MinDst, found, pts, THR, Ry, Rx, Rz, size_y, size_x, size_z);
+			break;
+		case mxUINT16_CLASS:
+			locmax_run((const unsigned short *)im_in, Mode, MinDst, found, pts, THR, Ry, Rx, Rz, size_y, size_x, size_z);
+			break;
+		case mxSINGLE_CLASS:
+			// Threshold compared in single precision as before
+			locmax_run((const float *)im_in, Mode, MinDst, found, pts, (double)(float)THR, Ry, Rx, Rz, size_y, size_x, size_z);
+			break;
+		default:
+			locmax_run((const double *)im_in, Mode, MinDst, found, pts, THR, Ry, Rx, Rz, size_y, size_x, size_z);
+			break;
+	}
+
+	plhs[0] = locmax_output(pts, ListOut, nDim, pDims);
     return;
-}
\ No newline at end of file
+}
@@ -0,0 +1,95 @@
+// PropagateComponents.h
+//
+// Component parallel mode shared by Propagate_3D_single.cpp and PropagateRegIntegrate.cpp:
+// the propagation never leaves the connected component of the mask holding the seed, so the
+// components holding seeds can be propagated independently (one queue per thread), writing
+// directly to the shared outputs. The output is identical to the serial propagation.
+// - connected components of the mask holding seeds (seed list + size)
+// - batches of components, largest first, small components grouped
+
+#ifndef PROPAGATECOMPONENTS_H
+#define PROPAGATECOMPONENTS_H
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+using namespace std;
+#include "mex.h"
+
+// Minimum number of voxels of a batch of small components
+#define MIN_BATCH_VOXELS 4096
+
+struct SeededComponent {
+  vector<mwSize> seeds;   // seeds of the component (linear index order)
+  size_t size;            // number of voxels
+  bool operator<(const SeededComponent &b) const { return size > b.size; }
+};
+
+// Batch: components [first,last) of the sorted component list
+struct ComponentBatch {
+  size_t first, last;
+  ComponentBatch(size_t f, size_t l) : first(f), last(l) {}
+};
+
+// Flood fill the mask from every seed (label > 0 within the mask) not yet reached.
+// conn: 6 (4 in 2D) or 26 (8 in 2D), must be the connectivity of the propagation.
+template <typename L>
+static void seeded_components(const mxLogical *mask, const L *labels, mwSize m, mwSize n, mwSize d, int conn,
+                              vector<SeededComponent> &comps)
+{
+  const mwSize mn = m*n, N = mn*d;
+  vector<unsigned char> reached(N, 0);
+  vector<mwSize> stack;
+  for (mwSize s = 0; s < N; s++) {
+    if ((! (labels[s] > 0)) || (! mask[s]) || reached[s]) continue;
+    comps.push_back(SeededComponent());
+    SeededComponent &c = comps.back();
+    c.size = 0;
+    reached[s] = 1;
+    stack.push_back(s);
+    while (! stack.empty()) {
+      const mwSize k = stack.back();
+      stack.pop_back();
+      c.size++;
+      if (labels[k] > 0) c.seeds.push_back(k);
+      const mwSize i = k%m, j = (k/m)%n, z = k/mn;
+      for (int dk = -1; dk <= 1; dk++) {
+        if (((dk < 0) && (z == 0)) || ((dk > 0) && (z == d-1))) continue;
+        for (int dj = -1; dj <= 1; dj++) {
+          if (((dj < 0) && (j == 0)) || ((dj > 0) && (j == n-1))) continue;
+          for (int di = -1; di <= 1; di++) {
+            if (((di < 0) && (i == 0)) || ((di > 0) && (i == m-1))) continue;
+            const int order = abs(di)+abs(dj)+abs(dk);
+            if ((order == 0) || ((conn == 6) && (order > 1))) continue;
+            const mwSize v = k+di+dj*(long long)m+dk*(long long)mn;
+            if (mask[v] && (! reached[v])) {
+              reached[v] = 1;
+              stack.push_back(v);
+            }
+          }
+        }
+      }
+    }
+    sort(c.seeds.begin(), c.seeds.end());
+  }
+}
+
+// Sort the components by decreasing size and group the small ones in batches of at least
+// MIN_BATCH_VOXELS voxels: handing the batches out largest first (dynamic schedule) keeps the
+// threads busy until the end without paying the scheduling cost of every small component.
+static void component_batches(vector<SeededComponent> &comps, vector<ComponentBatch> &batches)
+{
+  stable_sort(comps.begin(), comps.end());
+  size_t first = 0, voxels = 0;
+  for (size_t c = 0; c < comps.size(); c++) {
+    voxels += comps[c].size;
+    if (voxels >= MIN_BATCH_VOXELS) {
+      batches.push_back(ComponentBatch(first, c+1));
+      first = c+1;
+      voxels = 0;
+    }
+  }
+  if (first < comps.size()) batches.push_back(ComponentBatch(first, comps.size()));
+}
+
+#endif
@@ -6,17 +6,23 @@
 // Developed by the Whitehead Institute for Biomedical Research.    
 // Copyright 2003,2004,2005.                                        
 
-// call function with (labels, image, mask) as input.
+// call function with (labels, image, mask, nthreads) as input.
 // - labels are the nuclei
 // - image is the intensity to use to guide the segmentation
 // - mask is the foreground region of the image
+// - nthreads (optional) is the number of threads (1 or omitted: serial propagation), the
+//   8-connected components of the mask holding nuclei are then propagated in parallel
 
 // Output is
 // - labels
 // - distances (optional)
+// - number of distance calculations (optional), the 4 patch difference weights of every pixel
+//   are computed once before the propagation
 // - number of pop operations on the queue used for computation (optional)
-// - number of distance calculations.  (optional)
 // The last two, if requested, must be requested together.
+
+// Pixels are settled by increasing distance, equal distances by increasing label: the output
+// does not depend on the number of threads.
                                                                   
 // Authors:                                                         
 //   Anne Carpenter <carpenter@wi.mit.edu>                          
@@ -30,11 +36,14 @@
 #include <iostream>
 using namespace std;
 #include "mex.h"
+#include <omp.h>
+#include "PropagateComponents.h"
 
 // Input Arguments
 #define LABELS_IN       prhs[0]
 #define IM_IN           prhs[1]
 #define MASK_IN         prhs[2]
+#define NTHREADS_IN     prhs[3]
 
 // Output Arguments
 #define LABELS_OUT        plhs[0]
@@ -58,47 +67,64 @@ public:
 
 struct Pixel_compare { 
  bool operator() (const Pixel& a, const Pixel& b) const 
- { return a.distance > b.distance; }
+ { return (a.distance > b.distance) || ((a.distance == b.distance) && (a.label > b.label)); }
 };
 
 typedef priority_queue<Pixel, vector<Pixel>, Pixel_compare> PixelQueue;
 
-static double
-clamped_fetch(double *image, 
-              int i, int j,
-              int m, int n)
-{
-  if (i < 0) i = 0;
-  if (i >= m) i = m-1;
-  if (j < 0) j = 0;
-  if (j >= n) j = n-1;
+// Patch difference weights: W[d][IJ(i,j)] is the sum of the absolute differences between the
+// 3x3 patches (clamped to the image) centred on (i,j) and on (i,j) + offset d, for the 4
+// offsets below; the 4 other neighbours use the weight of the symmetric pair.
+static const int weight_di[4] = {1, 0, 1, 1};
+static const int weight_dj[4] = {0, 1, 1, -1};
 
-  return (image[IJ(i,j)]);
+static inline int
+clamp_index(int k, int n)
+{
+  if (k < 0) return 0;
+  if (k >= n) return n-1;
+  return k;
 }
 
-static double
-Difference(double *image,
-           int i1,  int j1,
-           int i2,  int j2,
-           unsigned int m, unsigned int n)
+// Computed once for the whole image, column by column (image columns padded by 2 clamped
+// pixels so that the inner loops run without boundary tests). The 9 terms of a weight are
+// accumulated in the same order as the former Difference() function.
+static void
+compute_weights(const double *image, unsigned int m, unsigned int n, double *W[4])
 {
-  int delta_i, delta_j;
-  double pixel_diff = 0.0;
-
-  // At some point, the width over which differences are calculated should probably be user controlled.
-  for (delta_j = -1; delta_j <= 1; delta_j++) {
-    for (delta_i = -1; delta_i <= 1; delta_i++) {
-      pixel_diff += fabs(clamped_fetch(image, i1 + delta_i, j1 + delta_j, m, n) - 
-                         clamped_fetch(image, i2 + delta_i, j2 + delta_j, m, n));
+  #pragma omp parallel
+  {
+    vector<double> pcols(5*(m+4));
+    vector<double> acc(m);
+
+    #pragma omp for schedule(dynamic,16)
+    for (int j = 0; j < (int)n; j++) {
+      // Columns j-2..j+2 (clamped), rows -2..m+1 (clamped)
+      for (int c = 0; c < 5; c++) {
+        const double *col = image+IJ(0,clamp_index(j+c-2,n));
+        double *pc = &pcols[c*(m+4)];
+        for (int r = 0; r < (int)m+4; r++) pc[r] = col[clamp_index(r-2,m)];
+      }
+      for (int d = 0; d < 4; d++) {
+        for (unsigned int i = 0; i < m; i++) acc[i] = 0.0;
+        for (int delta_j = -1; delta_j <= 1; delta_j++) {
+          const double *P1 = &pcols[(delta_j+2)*(m+4)]+2;
+          const double *P2 = &pcols[(delta_j+weight_dj[d]+2)*(m+4)]+2+weight_di[d];
+          for (int delta_i = -1; delta_i <= 1; delta_i++) {
+            for (int i = 0; i < (int)m; i++) acc[i] += fabs(P1[i+delta_i] - P2[i+delta_i]);
+          }
+        }
+        double *w = W[d]+IJ(0,j);
+        for (unsigned int i = 0; i < m; i++) w[i] = acc[i];
+      }
     }
   }
-  (*difference_count)++;
-  return pixel_diff;
+  (*difference_count) += 4.0*m*n;
 }
 
 static void
 push_neighbors_on_queue(PixelQueue &pq, double dist,
-                        double *image,
+                        double *W[4],
                         unsigned int i, unsigned int j,
                         unsigned int m, unsigned int n,
                         double label,
@@ -109,45 +135,102 @@ push_neighbors_on_queue(PixelQueue &pq, double dist,
   // 4-connected
   if (i > 0) {
     if ( 0 == labels_out[IJ(i-1,j)] ) // if the neighbour was not labelled, do pushing
-      pq.push(Pixel(dist + Difference(image, i, j, i-1, j, m, n), i-1, j, label));
+      pq.push(Pixel(dist + W[0][IJ(i-1,j)], i-1, j, label));
   }                                                                   
   if (j > 0) {                                                        
     if ( 0 == labels_out[IJ(i,j-1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i, j-1, m, n), i, j-1, label));
+      pq.push(Pixel(dist + W[1][IJ(i,j-1)], i, j-1, label));
   }                                                                   
   if (i < (m-1)) {
     if ( 0 == labels_out[IJ(i+1,j)] ) 
-      pq.push(Pixel(dist + Difference(image, i, j, i+1, j, m, n), i+1, j, label));
+      pq.push(Pixel(dist + W[0][IJ(i,j)], i+1, j, label));
   }                                                                   
   if (j < (n-1)) {              
     if ( 0 == labels_out[IJ(i,j+1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i, j+1, m, n), i, j+1, label));
+      pq.push(Pixel(dist + W[1][IJ(i,j)], i, j+1, label));
   } 
 
   // 8-connected
   if ((i > 0) && (j > 0)) {
     if ( 0 == labels_out[IJ(i-1,j-1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i-1, j-1, m, n), i-1, j-1, label));
+      pq.push(Pixel(dist + W[2][IJ(i-1,j-1)], i-1, j-1, label));
   }                                                                       
   if ((i < (m-1)) && (j > 0)) {                                           
     if ( 0 == labels_out[IJ(i+1,j-1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i+1, j-1, m, n), i+1, j-1, label));
+      pq.push(Pixel(dist + W[3][IJ(i,j)], i+1, j-1, label));
   }                                                                       
   if ((i > 0) && (j < (n-1))) {                                           
     if ( 0 == labels_out[IJ(i-1,j+1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i-1, j+1, m, n), i-1, j+1, label));
+      pq.push(Pixel(dist + W[3][IJ(i-1,j+1)], i-1, j+1, label));
   }                                                                       
   if ((i < (m-1)) && (j < (n-1))) {
     if ( 0 == labels_out[IJ(i+1,j+1)] )   
-      pq.push(Pixel(dist + Difference(image, i, j, i+1, j+1, m, n), i+1, j+1, label));
+      pq.push(Pixel(dist + W[2][IJ(i,j)], i+1, j+1, label));
   }
   
 }
 
+// Settle the queued pixels, returns the number of pop operations
+static double
+settle(PixelQueue &pixel_queue, double *W[4], mxLogical *mask_in, double *labels_out, double *dists,
+       unsigned int m, unsigned int n)
+{
+  double pops = 0;
+  while (! pixel_queue.empty()) {
+    Pixel p = pixel_queue.top();
+    pixel_queue.pop();
+    pops++;
+    
+    //    cout << "popped " << p.i << " " << p.j << endl;
+    
+    if (! mask_in[IJ(p.i, p.j)]) continue;
+    //    cout << "going on\n";
+
+    if ((dists[IJ(p.i, p.j)] > p.distance) && (mask_in[IJ(p.i,p.j)])) {
+      dists[IJ(p.i, p.j)] = p.distance;
+      labels_out[IJ(p.i, p.j)] = p.label;
+      push_neighbors_on_queue(pixel_queue, p.distance, W, p.i, p.j, m, n, p.label, labels_out);
+    }
+  }
+  return pops;
+}
+
+// Component mode: the batches of components are handed out to the threads (dynamic schedule),
+// every thread propagates its components in its own queue and writes to the shared outputs
+static void
+propagate_components(int nthreads, double *W[4], double *labels_in, mxLogical *mask_in, double *labels_out,
+                     double *dists, unsigned int m, unsigned int n)
+{
+  vector<SeededComponent> comps;
+  vector<ComponentBatch> batches;
+  seeded_components(mask_in, labels_in, m, n, 1, 26, comps);
+  component_batches(comps, batches);
+
+  #pragma omp parallel num_threads(nthreads)
+  {
+    PixelQueue pixel_queue;
+    double pops = 0;
+
+    #pragma omp for schedule(dynamic,1)
+    for (long long b = 0; b < (long long)batches.size(); b++) {
+      for (size_t c = batches[b].first; c < batches[b].last; c++) {
+        const vector<mwSize> &seeds = comps[c].seeds;
+        for (size_t s = 0; s < seeds.size(); s++) {
+          const unsigned int i = (unsigned int)(seeds[s]%m), j = (unsigned int)(seeds[s]/m);
+          push_neighbors_on_queue(pixel_queue, 0.0, W, i, j, m, n, labels_in[IJ(i,j)], labels_out);
+        }
+        pops += settle(pixel_queue, W, mask_in, labels_out, dists, m, n);
+      }
+    }
+    #pragma omp atomic
+    (*pop_count) += pops;
+  }
+}
+
 static void propagate(double *labels_in, double *im_in,
                       mxLogical *mask_in, double *labels_out,
                       double *dists,
-                      unsigned int m, unsigned int n)
+                      unsigned int m, unsigned int n, int nthreads)
 {
   // TODO: Initialization of nuclei labels can be simplified by labelling
   //       the nuclei region first, then make the queue prepared for 
@@ -156,6 +239,12 @@ static void propagate(double *labels_in, double *im_in,
   unsigned int i, j;
   PixelQueue pixel_queue;
 
+  // Patch difference weights of the 4 neighbour offsets
+  vector<double> weights(4*(size_t)m*n);
+  double *W[4];
+  for (int d = 0; d < 4; d++) W[d] = &weights[d*(size_t)m*n];
+  compute_weights(im_in, m, n, W);
+
   // initialize dist to Inf, read labels_in and write out to labels_out
   for (j = 0; j < n; j++) {
     for (i = 0; i < m; i++) {
@@ -164,33 +253,19 @@ static void propagate(double *labels_in, double *im_in,
     }
   }
   // if the pixel is already labelled (i.e, labelled in labels_in) and within a mask, 
-  // then set dist to 0 and push its neighbours for propagation */
+  // then set dist to 0 (and push its neighbours for propagation in serial mode)
   for (j = 0; j < n; j++) {
     for (i = 0; i < m; i++) {        
       double label = labels_in[IJ(i,j)];
       if ((label > 0) && (mask_in[IJ(i,j)])) {
         dists[IJ(i,j)] = 0.0;
-        push_neighbors_on_queue(pixel_queue, 0.0, im_in, i, j, m, n, label, labels_out);
+        if (nthreads <= 1) push_neighbors_on_queue(pixel_queue, 0.0, W, i, j, m, n, label, labels_out);
       }
     }
   }
 
-  while (! pixel_queue.empty()) {
-    Pixel p = pixel_queue.top();
-    pixel_queue.pop();
-    (*pop_count)++;
-    
-    //    cout << "popped " << p.i << " " << p.j << endl;
-    
-    if (! mask_in[IJ(p.i, p.j)]) continue;
-    //    cout << "going on\n";
-
-    if ((dists[IJ(p.i, p.j)] > p.distance) && (mask_in[IJ(p.i,p.j)])) {
-      dists[IJ(p.i, p.j)] = p.distance;
-      labels_out[IJ(p.i, p.j)] = p.label;
-      push_neighbors_on_queue(pixel_queue, p.distance, im_in, p.i, p.j, m, n, p.label, labels_out);
-    }
-  }
+  if (nthreads > 1) propagate_components(nthreads, W, labels_in, mask_in, labels_out, dists, m, n);
+  else (*pop_count) += settle(pixel_queue, W, mask_in, labels_out, dists, m, n);
 }
 
 void mexFunction( int nlhs, mxArray *plhs[], 
@@ -201,11 +276,12 @@ void mexFunction( int nlhs, mxArray *plhs[],
     mxLogical *mask_in;
     double *labels_out, *dists;   
     unsigned int m, n; 
+    int nthreads = 1;
     
     // Check for proper number of arguments
     
-    if (nrhs != 3) { 
-        mexErrMsgTxt("Three input arguments required."); 
+    if ((nrhs < 3) || (nrhs > 4)) { 
+        mexErrMsgTxt("Three or four input arguments required."); 
     } else if (nlhs !=1 && nlhs !=2 && nlhs !=3) {
         mexErrMsgTxt("The number of output arguments should be 1, 2, or 3."); 
     } 
@@ -242,13 +318,14 @@ void mexFunction( int nlhs, mxArray *plhs[],
     im_in = mxGetPr(IM_IN);
     mask_in = mxGetLogicals(MASK_IN);
     labels_out = mxGetPr(LABELS_OUT);
+    if (nrhs > 3) nthreads = (int)mxGetScalar(NTHREADS_IN);
 
     // Do the actual computations in a subroutine
     dists = mxGetPr(DISTANCES_OUT);
     difference_count = mxGetPr(DIFF_COUNT_OUT);
     pop_count = mxGetPr(POP_COUNT_OUT);
 
-    propagate(labels_in, im_in, mask_in, labels_out, dists, m, n); 
+    propagate(labels_in, im_in, mask_in, labels_out, dists, m, n, nthreads); 
     
     if (nlhs <= 2) {
       mxDestroyArray(DIFF_COUNT_OUT);
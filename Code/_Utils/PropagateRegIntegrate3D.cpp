@@ -0,0 +1,256 @@
+// PropagateRegIntegrate3D.cpp
+
+// CellProfiler is distributed under the GNU General Public License.
+// See the accompanying file LICENSE for details.                   
+
+// Developed by the Whitehead Institute for Biomedical Research.    
+// Copyright 2003,2004,2005.                                        
+
+// 3D version of PropagateRegIntegrate: the cost of a step is the sum of the absolute differences
+// between the 3x3x3 patches centred on both voxels (less leaky than the single voxel difference
+// of Propagate_3D_single).
+
+// call function with (labels, image, mask, conn, zratio) as input.
+// - labels are the seeds (single, uint16 or uint32, the output labels have the same class)
+// - image is the intensity to use to guide the segmentation (uint8, uint16, single or double)
+// - mask is the foreground region of the image (logical)
+// - conn (optional) is the connectivity: 6, 18 or 26 (default)
+// - zratio (optional) is the z / xy voxel size ratio (default 1): the cost of a step is scaled by
+//   its physical length relative to the same step on an isotropic grid (z steps by zratio)
+
+// Output is
+// - labels
+// - distances (optional)
+
+// The image and the mask are copied to a volume padded by one voxel (image replicated, mask false)
+// so that neither the patch offsets nor the neighbour offsets need bound checks. Voxels are settled
+// by increasing distance, equal distances by increasing label.
+
+// Authors:                                                         
+//   Anne Carpenter <carpenter@wi.mit.edu>                          
+//   Thouis Jones   <thouis@csail.mit.edu>                          
+//   In Han Kang    <inthek@mit.edu>                                
+//   Kyungnam Kim   <kkim@broad.mit.edu>
+//   Sébastien Tosi, 3D support 
+
+#include <math.h>
+#include <stdlib.h>
+#include <queue>
+#include <vector>
+using namespace std;
+#include "mex.h"
+
+// Input Arguments
+#define LABELS_IN       prhs[0]
+#define IM_IN           prhs[1]
+#define MASK_IN         prhs[2]
+#define CONN_IN         prhs[3]
+#define ZRATIO_IN       prhs[4]
+
+// Output Arguments
+#define LABELS_OUT        plhs[0]
+#define DISTANCES_OUT     plhs[1]
+
+// Voxel states in the padded volume
+#define OPEN      0
+#define SETTLED   1
+
+template <typename L>
+class Voxel {
+public:
+  float distance;
+  L label;
+  mwSize k;     // padded index
+  Voxel (float ds, L l, mwSize ind) : distance(ds), label(l), k(ind) {}
+};
+
+template <typename L>
+struct Voxel_compare {
+  bool operator() (const Voxel<L>& a, const Voxel<L>& b) const
+  { return (a.distance > b.distance) || ((a.distance == b.distance) && (a.label > b.label)); }
+};
+
+// Padded geometry, neighbour and patch offset tables
+struct Grid {
+  mwSize m, n, d;             // original size
+  mwSize pm, pmn;             // padded strides
+  int nnb;
+  long long nb[26];           // neighbour offsets (padded)
+  float scale[26];            // step cost scale
+  long long patch[27];        // 3x3x3 patch offsets (padded)
+
+  Grid(mwSize m_, mwSize n_, mwSize d_, int conn, double zratio) : m(m_), n(n_), d(d_)
+  {
+    pm = m+2;
+    pmn = pm*(n+2);
+    nnb = 0;
+    int np = 0;
+    for (int dk = -1; dk <= 1; dk++)
+      for (int dj = -1; dj <= 1; dj++)
+        for (int di = -1; di <= 1; di++) {
+          const long long off = di+dj*(long long)pm+dk*(long long)pmn;
+          patch[np++] = off;
+          const int order = abs(di)+abs(dj)+abs(dk);
+          if ((order == 0) || ((conn == 6) && (order > 1)) || ((conn == 18) && (order > 2))) continue;
+          nb[nnb] = off;
+          scale[nnb] = (float)sqrt((di*di+dj*dj+zratio*zratio*dk*dk)/(double)order);
+          nnb++;
+        }
+  }
+  mwSize padded(mwSize k) const { return (k%m+1)+((k/m)%n+1)*pm+(k/(m*n)+1)*pmn; }
+  mwSize original(mwSize p) const { return (p%pm-1)+((p/pm)%(n+2)-1)*m+(p/pmn-1)*m*n; }
+};
+
+// Patch difference between the voxels p and q (padded indices)
+static inline float
+patch_difference(const float *P, const Grid &g, mwSize p, mwSize q)
+{
+  float diff = 0;
+  for (int o = 0; o < 27; o++) diff += fabs(P[p+g.patch[o]]-P[q+g.patch[o]]);
+  return diff;
+}
+
+template <typename L>
+static void
+push_neighbors_on_queue(priority_queue< Voxel<L>, vector< Voxel<L> >, Voxel_compare<L> > &pq, float dist,
+                        const float *P, const unsigned char *state, const Grid &g, mwSize p, L label)
+{
+  for (int t = 0; t < g.nnb; t++) {
+    const mwSize q = p+g.nb[t];
+    if (state[q] == OPEN) pq.push(Voxel<L>(dist+g.scale[t]*patch_difference(P, g, p, q), label, q));
+  }
+}
+
+template <typename T, typename L>
+static void propagate(const T *im_in, const mxLogical *mask_in, L *labels_out, float *dists, const Grid &g)
+{
+  const mwSize m = g.m, n = g.n, d = g.d;
+  const mwSize pN = g.pmn*(d+2);
+
+  // Padded image (replicated borders) and states (padding, outside mask and seeds are settled)
+  vector<float> P(pN);
+  vector<unsigned char> state(pN, SETTLED);
+  for (mwSize pk = 0; pk < d+2; pk++) {
+    const mwSize k = (pk == 0) ? 0 : ((pk > d) ? d-1 : pk-1);
+    for (mwSize pj = 0; pj < n+2; pj++) {
+      const mwSize j = (pj == 0) ? 0 : ((pj > n) ? n-1 : pj-1);
+      const T *src = im_in+j*m+k*m*n;
+      float *dst = &P[pj*g.pm+pk*g.pmn];
+      dst[0] = (float)src[0];
+      for (mwSize i = 0; i < m; i++) dst[i+1] = (float)src[i];
+      dst[m+1] = (float)src[m-1];
+    }
+  }
+  for (mwSize k = 0; k < m*n*d; k++) {
+    if (dists) dists[k] = mxGetInf();
+    if (mask_in[k] && (labels_out[k] == 0)) state[g.padded(k)] = OPEN;
+  }
+
+  // Seeds within the mask
+  priority_queue< Voxel<L>, vector< Voxel<L> >, Voxel_compare<L> > pixel_queue;
+  for (mwSize k = 0; k < m*n*d; k++) {
+    if ((labels_out[k] > 0) && mask_in[k]) {
+      if (dists) dists[k] = 0;
+      push_neighbors_on_queue(pixel_queue, 0.0f, &P[0], &state[0], g, g.padded(k), labels_out[k]);
+    }
+  }
+
+  while (! pixel_queue.empty()) {
+    const Voxel<L> p = pixel_queue.top();
+    pixel_queue.pop();
+    if (state[p.k] != OPEN) continue;
+    state[p.k] = SETTLED;
+    const mwSize k = g.original(p.k);
+    if (dists) dists[k] = p.distance;
+    labels_out[k] = p.label;
+    push_neighbors_on_queue(pixel_queue, p.distance, &P[0], &state[0], g, p.k, p.label);
+  }
+}
+
+template <typename L>
+static void propagate_image(mxClassID im_class, const void *im_in, const mxLogical *mask_in, L *labels_out,
+                            float *dists, const Grid &g)
+{
+  switch (im_class) {
+    case mxUINT8_CLASS:
+      propagate((const unsigned char *)im_in, mask_in, labels_out, dists, g);
+      break;
+    case mxUINT16_CLASS:
+      propagate((const unsigned short *)im_in, mask_in, labels_out, dists, g);
+      break;
+    case mxSINGLE_CLASS:
+      propagate((const float *)im_in, mask_in, labels_out, dists, g);
+      break;
+    default:
+      propagate((const double *)im_in, mask_in, labels_out, dists, g);
+      break;
+  }
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+                  int nrhs, const mxArray*prhs[] )
+{
+    mxClassID im_class, lbl_class;
+    float *dists = NULL;
+    int conn = 26;
+    double zratio = 1;
+
+    // Check for proper number of arguments
+    if ((nrhs < 3) || (nrhs > 5)) {
+        mexErrMsgTxt("Three to five input arguments required.");
+    } else if (nlhs > 2) {
+        mexErrMsgTxt("The number of output arguments should be 1 or 2.");
+    }
+
+    const mwSize nDim = mxGetNumberOfDimensions(IM_IN);
+    const mwSize *pDims = mxGetDimensions(IM_IN);
+    const mwSize m = pDims[0];
+    const mwSize n = (nDim > 1) ? pDims[1] : 1;
+    const mwSize d = (nDim > 2) ? pDims[2] : 1;
+
+    if ((mxGetNumberOfElements(LABELS_IN) != m*n*d) || (mxGetNumberOfElements(MASK_IN) != m*n*d)) {
+      mexErrMsgTxt("Labels, image and mask must have same size.");
+    }
+    lbl_class = mxGetClassID(LABELS_IN);
+    if ((lbl_class != mxSINGLE_CLASS) && (lbl_class != mxUINT16_CLASS) && (lbl_class != mxUINT32_CLASS)) {
+      mexErrMsgTxt("First argument must be a single, uint16 or uint32 array.");
+    }
+    im_class = mxGetClassID(IM_IN);
+    if ((im_class != mxUINT8_CLASS) && (im_class != mxUINT16_CLASS) && (im_class != mxSINGLE_CLASS) && (im_class != mxDOUBLE_CLASS)) {
+      mexErrMsgTxt("Second argument must be a uint8, uint16, single or double array.");
+    }
+    if (! mxIsLogical(MASK_IN)) {
+      mexErrMsgTxt("Third argument must be a logical array.");
+    }
+    if (nrhs > 3) conn = (int)mxGetScalar(CONN_IN);
+    if (nrhs > 4) zratio = mxGetScalar(ZRATIO_IN);
+    if ((conn != 6) && (conn != 18) && (conn != 26)) {
+      mexErrMsgTxt("Connectivity must be 6, 18 or 26.");
+    }
+
+    // Labels are propagated in the copy of the seeds
+    LABELS_OUT = mxDuplicateArray(LABELS_IN);
+    if (nlhs > 1) {
+      DISTANCES_OUT = mxCreateNumericArray(nDim, pDims, mxSINGLE_CLASS, mxREAL);
+      dists = (float *)mxGetData(DISTANCES_OUT);
+    }
+    if (m*n*d == 0) return;
+
+    const Grid g(m, n, d, conn, zratio);
+    const void *im_in = mxGetData(IM_IN);
+    const mxLogical *mask_in = mxGetLogicals(MASK_IN);
+    void *labels_out = mxGetData(LABELS_OUT);
+    switch (lbl_class) {
+      case mxUINT16_CLASS:
+        propagate_image(im_class, im_in, mask_in, (unsigned short *)labels_out, dists, g);
+        break;
+      case mxUINT32_CLASS:
+        propagate_image(im_class, im_in, mask_in, (unsigned int *)labels_out, dists, g);
+        break;
+      default:
+        propagate_image(im_class, im_in, mask_in, (float *)labels_out, dists, g);
+        break;
+    }
+
+    return;
+}
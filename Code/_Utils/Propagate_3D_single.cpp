@@ -6,14 +6,24 @@
 // Developed by the Whitehead Institute for Biomedical Research.    
 // Copyright 2003,2004,2005.                                        
 
-// call function with (labels, image, mask) as input.
-// - labels are the seeds
-// - image is the intensity to use to guide the segmentation
+// call function with (labels, image, mask, nplanes, engine, bucket_width, nthreads, mode) as input.
+// - labels are the seeds (single, uint16 or uint32, the output labels have the same class)
+// - image is the intensity to use to guide the segmentation (uint8, uint16, single or double)
 // - mask is the foreground region of the image
+// - nplanes is the number of planes of the stack
+// - engine (optional) is the priority queue: 0 binary heap (default), 1 bucket queue
+// - bucket_width (optional) is the distance range of a bucket (0 or omitted: calibrated from the image)
+// - nthreads (optional) is the number of threads (1 or omitted: serial propagation)
+// - mode (optional) is the parallel mode: 0 z slabs (default), 1 connected components of the mask
 
 // Output is
 // - labels
-// - distances (optional)
+// - distances (optional, only computed if requested)
+
+// Voxels are settled by increasing distance, equal distances by increasing label: the output
+// does not depend on the queue engine.
+// Queue entries only hold the distance and the linear index of the voxel tagged with the
+// direction of the voxel it was pushed from: the label is read back from the output labels.
                                                                   
 // Authors:                                                         
 //   Anne Carpenter <carpenter@wi.mit.edu>                          
@@ -28,12 +38,18 @@
 #include <iostream>
 using namespace std;
 #include "mex.h"
+#include <omp.h>
+#include "PropagateComponents.h"
 
 // Input Arguments
 #define LABELS_IN       prhs[0]
 #define IM_IN           prhs[1]
 #define MASK_IN         prhs[2]
 #define NPLANES_IN		prhs[3]
+#define ENGINE_IN		prhs[4]
+#define WIDTH_IN		prhs[5]
+#define NTHREADS_IN		prhs[6]
+#define MODE_IN			prhs[7]
 
 // Output Arguments
 #define LABELS_OUT        plhs[0]
@@ -42,116 +58,544 @@ using namespace std;
 
 #define IJ(i,j) ((j)*m+(i))
 
+// Queue entry code: linear index (low bits) + direction of the source voxel (3 high bits)
+#define DIR_SHIFT 61
+#define INDEX_MASK ((1ULL<<DIR_SHIFT)-1)
+
+// Packed to 12 bytes (float + 64-bit code, no padding): the queues hold one entry per push
+#pragma pack(push,4)
 class Pixel { 
 public:
   float distance;
-  unsigned int i, j;
-  float label;
-  Pixel (float ds, unsigned int ini, unsigned int inj, float l) : 
-    distance(ds), i(ini), j(inj), label(l) {}
+  unsigned long long code;
+  Pixel (float ds, mwSize k, unsigned int dir) : 
+    distance(ds), code(k | ((unsigned long long)dir<<DIR_SHIFT)) {}
+  mwSize index() const { return (mwSize)(code & INDEX_MASK); }
+  unsigned int dir() const { return (unsigned int)(code>>DIR_SHIFT); }
+};
+#pragma pack(pop)
+
+// Neighbour offsets: the source of an entry is index - offset[dir]
+struct Neighbours {
+  mwSize offset[6];
+  Neighbours(mwSize m, mwSize n) {
+    offset[0] = (mwSize)-1; offset[1] = (mwSize)-(long long)m; offset[2] = 1;
+    offset[3] = m; offset[4] = m*n; offset[5] = (mwSize)-(long long)(m*n);
+  }
+  mwSize source(const Pixel &p) const { return p.index()-offset[p.dir()]; }
 };
 
+template <typename L>
 struct Pixel_compare { 
- bool operator() (const Pixel& a, const Pixel& b) const 
- { return a.distance > b.distance; }
+  const L *labels;
+  const Neighbours *nb;
+  Pixel_compare(const L *lbl, const Neighbours *nbs) : labels(lbl), nb(nbs) {}
+  bool operator() (const Pixel& a, const Pixel& b) const 
+  { return (a.distance > b.distance) || ((a.distance == b.distance) && (labels[nb->source(a)] > labels[nb->source(b)])); }
+};
+
+// Monotone bucket queue (Dial): distances are quantized to buckets of fixed width held in a
+// circular array, the current bucket is ordered in a small heap so that the pop order is exact.
+// Pushes never fall below the current bucket (non negative edge weights); the rare pushes
+// beyond the ring span are parked in an overflow list until the ring reaches them.
+template <typename P, typename C>
+class BucketQueue {
+public:
+  BucketQueue(double width, double max_step, const C &comp) : inv_width(1.0/width), cur(0), ring_count(0), overflow_min(0), current(comp)
+  {
+    size_t nb = 2;
+    while ((nb < (max_step*inv_width)+2) && (nb < 65536)) nb <<= 1;
+    ring.resize(nb);
+    span = nb-1;
+  }
+  bool empty() const { return current.empty() && (ring_count == 0) && overflow.empty(); }
+  void push(const P &p)
+  {
+    const unsigned long long b = bucket(p.distance);
+    if (b <= cur) current.push(p);
+    else if (b-cur <= span) { ring[b&span].push_back(p); ring_count++; }
+    else {
+      if (overflow.empty() || (b < overflow_min)) overflow_min = b;
+      overflow.push_back(p);
+    }
+  }
+  const P &top() { advance(); return current.top(); }
+  void pop() { current.pop(); }
+  // Restart from distance 0 (empty queue only)
+  void reset() { cur = 0; }
+
+private:
+  unsigned long long bucket(float distance) const { return (unsigned long long)(distance*inv_width); }
+
+  // Move to the next non empty bucket
+  void advance()
+  {
+    while (current.empty()) {
+      if ((ring_count == 0) && (! overflow.empty()) && (overflow_min > cur+1)) cur = overflow_min-1;
+      cur++;
+      vector<P> &slot = ring[cur&span];
+      for (size_t k = 0; k < slot.size(); k++) current.push(slot[k]);
+      ring_count -= slot.size();
+      vector<P>().swap(slot);
+      if ((! overflow.empty()) && (cur >= overflow_min)) {
+        vector<P> parked;
+        parked.swap(overflow);
+        for (size_t k = 0; k < parked.size(); k++) push(parked[k]);
+      }
+    }
+  }
+
+  double inv_width;
+  unsigned long long cur, span;
+  size_t ring_count;
+  unsigned long long overflow_min;
+  vector< vector<P> > ring;
+  vector<P> overflow;
+  priority_queue<P, vector<P>, C> current;
 };
 
-typedef priority_queue<Pixel, vector<Pixel>, Pixel_compare> PixelQueue;
+// Intensity difference between two voxels (computed in single precision whatever the image class)
+template <typename T>
+static inline float
+absdiff(const T *image, mwSize a, mwSize b)
+{
+  return fabs((float)image[a] - (float)image[b]);
+}
+
+// Settled voxels bitmap
+#define FINALIZED(k) ((finalized[(k)>>6]>>((k)&63))&1)
+#define FINALIZE(k) (finalized[(k)>>6] |= (1ULL<<((k)&63)))
+
+// Settled voxels of the serial engine (one bit per voxel)
+class SettledBits {
+public:
+  SettledBits(mwSize N) : finalized((N+63)/64, 0) {}
+  bool operator()(mwSize k) const { return FINALIZED(k); }
+  void set(mwSize k) { FINALIZE(k); }
+private:
+  vector<unsigned long long> finalized;
+};
 
+// Settled voxels of the component engine (one byte per voxel: the threads propagating
+// different components never write to the same word)
+class SettledBytes {
+public:
+  SettledBytes(mwSize N) : finalized(N, 0) {}
+  bool operator()(mwSize k) const { return finalized[k] != 0; }
+  void set(mwSize k) { finalized[k] = 1; }
+private:
+  vector<unsigned char> finalized;
+};
+
+template <typename T, typename Q, typename S>
 static void
-push_neighbors_on_queue(PixelQueue &pq, float dist,
-                        float *image,
-                        unsigned int i, unsigned int j,
-                        unsigned int m, unsigned int n, unsigned d,
-                        float label,
-                        float *labels_out)
+push_neighbors_on_queue(Q &pq, float dist,
+                        const T *image,
+                        mwSize i, mwSize j,
+                        mwSize m, mwSize n, mwSize d,
+                        const S &finalized)
 {
-  // TODO: Check if the neighbour is already labelled. If so, skip pushing.      
+  // Settled neighbours (seeds, labelled voxels and voxels outside the mask) are never pushed
   // 6-connected
   if (i > 0) {
-    if ( 0 == labels_out[IJ(i-1,j)] ) // if the neighbour was not labelled, do pushing
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i-1,j)]), i-1, j, label));
+    if (! finalized(IJ(i-1,j)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i-1,j)), IJ(i-1,j), 0));
   }                                                                   
-  if (j > 0) {                                                        
-    if ( 0 == labels_out[IJ(i,j-1)] )   
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i,j-1)]), i, j-1, label));
+  if ((j%n) > 0) {                                                        
+    if (! finalized(IJ(i,j-1)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i,j-1)), IJ(i,j-1), 1));
   }                                                                   
   if (i < (m-1)) {
-    if ( 0 == labels_out[IJ(i+1,j)] ) 
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i+1,j)]), i+1, j, label));
+    if (! finalized(IJ(i+1,j)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i+1,j)), IJ(i+1,j), 2));
   }                                                                              
   if ((j%n)<(n-1)) { 
-   if ( 0 == labels_out[IJ(i,j+1)] )   
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i,j+1)]), i, j+1, label));
+    if (! finalized(IJ(i,j+1)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i,j+1)), IJ(i,j+1), 3));
   }
   if (j < d*n-n) {
-    if ( 0 == labels_out[IJ(i,j+n)] ) 
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i,j+n)]), i, j+n, label));
+    if (! finalized(IJ(i,j+n)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i,j+n)), IJ(i,j+n), 4));
   }
   if (j >= n) {              
-    if ( 0 == labels_out[IJ(i,j-n)] )   
-	  pq.push(Pixel(dist + fabs(image[IJ(i,j)] - image[IJ(i,j-n)]), i, j-n, label));
+    if (! finalized(IJ(i,j-n)))
+	  pq.push(Pixel(dist + absdiff(image, IJ(i,j), IJ(i,j-n)), IJ(i,j-n), 5));
   }
 }
 
-static void propagate(float *labels_in, float *im_in,
-                      mxLogical *mask_in, float *labels_out,
-                      float *dists,
-                      unsigned int m, unsigned int n, unsigned int d)
+// Initialize dist to Inf (0 for the seeds) and the settled voxels
+template <typename L, typename S>
+static void
+init_settled(const mxLogical *mask_in, const L *labels_out, float *dists, S &finalized, mwSize N)
 {
-  // TODO: Initialization of nuclei labels can be simplified by labelling
-  //       the nuclei region first, then make the queue prepared for 
-  //       propagation
-  //
-  unsigned int i, j;
-  PixelQueue pixel_queue;
-
-  // Initialize dist to Inf, read labels_in and write out to labels_out
-  for (j = 0; j < n*d; j++) {
-    for (i = 0; i < m; i++) {
-      dists[IJ(i,j)] = mxGetInf();            
-      labels_out[IJ(i,j)] = labels_in[IJ(i,j)];
-    }
+  for (mwSize k = 0; k < N; k++) {
+    if (dists) dists[k] = ((labels_out[k] > 0) && mask_in[k]) ? 0 : mxGetInf();
+    if ((labels_out[k] != 0) || (! mask_in[k])) finalized.set(k);
   }
-  
+}
+
+// Settle the queued voxels by increasing (distance,label)
+template <typename T, typename L, typename Q, typename S>
+static void
+settle(Q &pixel_queue, const Neighbours &nb, const T *im_in, L *labels_out, float *dists, S &finalized,
+       mwSize m, mwSize n, mwSize d)
+{
+  while (! pixel_queue.empty()) {
+    Pixel p = pixel_queue.top();
+    pixel_queue.pop();
+    const mwSize k = p.index();
+    if (finalized(k)) continue;
+    finalized.set(k);
+    if (dists) dists[k] = p.distance;
+    labels_out[k] = labels_out[nb.source(p)];
+    push_neighbors_on_queue(pixel_queue, p.distance, im_in, k%m, k/m, m, n, d, finalized);
+  }
+}
+
+// labels_out holds the seeds on entry, dists can be NULL
+template <typename T, typename L, typename Q>
+static void propagate(Q &pixel_queue, const Neighbours &nb, const T *im_in,
+                      mxLogical *mask_in, L *labels_out,
+                      float *dists,
+                      mwSize m, mwSize n, mwSize d)
+{
+  mwSize i, j;
+  SettledBits finalized(m*n*d);
+  init_settled(mask_in, labels_out, dists, finalized, m*n*d);
+
   // If the pixel is already labelled (i.e, labelled in labels_in) and within a mask, 
-  // then set dist to 0 and push its neighbours for propagation */
+  // then push its neighbours for propagation
   for (j = 0; j < n*d; j++) {
     for (i = 0; i < m; i++) {        
-      float label = labels_in[IJ(i,j)];
-      if ((label > 0) && (mask_in[IJ(i,j)])) {
-        dists[IJ(i,j)] = 0.0;
-        push_neighbors_on_queue(pixel_queue, 0.0, im_in, i, j, m, n, d, label, labels_out);
+      if ((labels_out[IJ(i,j)] > 0) && (mask_in[IJ(i,j)]))
+        push_neighbors_on_queue(pixel_queue, 0.0, im_in, i, j, m, n, d, finalized);
+    }
+  }
+
+  settle(pixel_queue, nb, im_in, labels_out, dists, finalized, m, n, d);
+}
+
+// Restart an empty queue from distance 0 (only the bucket queue keeps a position)
+template <typename P, typename C>
+static inline void restart(BucketQueue<P,C> &pq) { pq.reset(); }
+template <typename Q>
+static inline void restart(Q &) {}
+
+// Component engine: the batches of components are handed out to the threads (dynamic schedule),
+// every thread propagates its components in its own queue
+template <typename T, typename L, typename Q>
+static void
+propagate_batches(Q &pixel_queue, const Neighbours &nb, const T *im_in, L *labels_out, float *dists,
+                  SettledBytes &finalized, const vector<SeededComponent> &comps,
+                  const vector<ComponentBatch> &batches, mwSize m, mwSize n, mwSize d)
+{
+  #pragma omp for schedule(dynamic,1)
+  for (long long b = 0; b < (long long)batches.size(); b++) {
+    for (size_t c = batches[b].first; c < batches[b].last; c++) {
+      const vector<mwSize> &seeds = comps[c].seeds;
+      restart(pixel_queue);
+      for (size_t s = 0; s < seeds.size(); s++)
+        push_neighbors_on_queue(pixel_queue, 0.0, im_in, seeds[s]%m, seeds[s]/m, m, n, d, finalized);
+      settle(pixel_queue, nb, im_in, labels_out, dists, finalized, m, n, d);
+    }
+  }
+}
+
+template <typename T, typename L>
+static void propagate_components(int nthreads, int engine, double width, double max_step, const T *im_in,
+                                 mxLogical *mask_in, L *labels_out,
+                                 float *dists,
+                                 mwSize m, mwSize n, mwSize d)
+{
+  const Neighbours nb(m, n);
+  const Pixel_compare<L> comp(labels_out, &nb);
+  SettledBytes finalized(m*n*d);
+  init_settled(mask_in, labels_out, dists, finalized, m*n*d);
+
+  // 6-connected components of the mask holding seeds
+  vector<SeededComponent> comps;
+  vector<ComponentBatch> batches;
+  seeded_components(mask_in, labels_out, m, n, d, 6, comps);
+  component_batches(comps, batches);
+
+  #pragma omp parallel num_threads(nthreads)
+  {
+    if (engine == 1) {
+      BucketQueue< Pixel, Pixel_compare<L> > pixel_queue(width, max_step, comp);
+      propagate_batches(pixel_queue, nb, im_in, labels_out, dists, finalized, comps, batches, m, n, d);
+    } else {
+      priority_queue<Pixel, vector<Pixel>, Pixel_compare<L> > pixel_queue(comp);
+      propagate_batches(pixel_queue, nb, im_in, labels_out, dists, finalized, comps, batches, m, n, d);
+    }
+  }
+}
+
+// Bucket width: a fraction of the mean non zero intensity step inside the mask (sampled along y),
+// small enough for the current bucket heap to stay short. Also returns the largest possible step.
+template <typename T>
+static double calibrate_bucket_width(const T *im_in, const mxLogical *mask_in, mwSize N, double &max_step)
+{
+  float vmin = (float)im_in[0], vmax = (float)im_in[0];
+  double sum = 0;
+  size_t cnt = 0;
+  for (mwSize k = 0; k < N; k++) {
+    const float v = (float)im_in[k];
+    if (v < vmin) vmin = v;
+    if (v > vmax) vmax = v;
+    if ((k%7 == 0) && (k+1 < N) && mask_in[k] && mask_in[k+1]) {
+      const float dv = absdiff(im_in, k, k+1);
+      if (dv > 0) { sum += dv; cnt++; }
+    }
+  }
+  max_step = (double)vmax - (double)vmin;
+  if (cnt == 0) return (max_step > 0) ? max_step : 1;
+  return sum/cnt/64;
+}
+
+// Parallel engine: the stack is split in z slabs propagated independently (one front per slab and
+// per thread), a voxel is relabelled whenever it is reached with a smaller (distance,label). The keys
+// of the voxels on both sides of the slab faces are then exchanged and the slabs are propagated again
+// from the improved face voxels, until nothing changes. The fixed point is the serial output.
+
+// Queue entry of the parallel engine (the label is carried: face voxels are relabelled across runs)
+template <typename L>
+class SlabPixel {
+public:
+  float distance;
+  L label;
+  mwSize k;
+  SlabPixel (float ds, L l, mwSize ind) : distance(ds), label(l), k(ind) {}
+};
+
+template <typename L>
+struct SlabPixel_compare { 
+  bool operator() (const SlabPixel<L>& a, const SlabPixel<L>& b) const 
+  { return (a.distance > b.distance) || ((a.distance == b.distance) && (a.label > b.label)); }
+};
+
+// Slab of planes [z0,z1)
+template <typename L>
+struct Slab {
+  mwSize z0, z1;
+  bool changed_lo, changed_hi;      // keys changed on the first / last plane during the last run
+  vector< SlabPixel<L> > to_lo, to_hi;  // improved voxels of the planes below / above the face to the next slab
+};
+
+template <typename T, typename L>
+struct SlabContext {
+  const T *image;
+  const mxLogical *mask;
+  L *labels;
+  float *dists;
+  const vector<unsigned long long> *fixed;
+  mwSize m, n, d;
+};
+
+// (dist,label) smaller than the current key of voxel k
+template <typename L>
+static inline bool
+improves(float dist, L label, mwSize k, const float *dists, const L *labels)
+{
+  return (dist < dists[k]) || ((dist == dists[k]) && (label < labels[k]));
+}
+
+// Push the neighbours of voxel k lying in planes [z0,z1) that its key improves
+template <typename T, typename L, typename Q>
+static void
+push_slab_neighbors(Q &pq, const SlabContext<T,L> &c, mwSize k, mwSize z0, mwSize z1)
+{
+  const vector<unsigned long long> &finalized = *c.fixed;
+  const mwSize m = c.m, mn = c.m*c.n;
+  const mwSize i = k%m, col = (k/m)%c.n, z = k/mn;
+  const float dist = c.dists[k];
+  const L label = c.labels[k];
+  mwSize nbr[6];
+  int cnt = 0;
+  if (i > 0) nbr[cnt++] = k-1;
+  if (col > 0) nbr[cnt++] = k-m;
+  if (i < m-1) nbr[cnt++] = k+1;
+  if (col < c.n-1) nbr[cnt++] = k+m;
+  if (z+1 < z1) nbr[cnt++] = k+mn;
+  if (z > z0) nbr[cnt++] = k-mn;
+  for (int t = 0; t < cnt; t++) {
+    const mwSize v = nbr[t];
+    if (FINALIZED(v)) continue;
+    const float nd = dist + absdiff(c.image, k, v);
+    if (improves(nd, label, v, c.dists, c.labels)) pq.push(SlabPixel<L>(nd, label, v));
+  }
+}
+
+// Propagate the entries of a slab queue (first run: seeds of the slab)
+template <typename T, typename L, typename Q>
+static void
+run_slab(Q &pq, const SlabContext<T,L> &c, Slab<L> &sl, bool first)
+{
+  const mwSize mn = c.m*c.n;
+  sl.changed_lo = sl.changed_hi = first;
+  if (first) {
+    for (mwSize k = sl.z0*mn; k < sl.z1*mn; k++)
+      if ((c.labels[k] > 0) && c.mask[k]) push_slab_neighbors(pq, c, k, sl.z0, sl.z1);
+  }
+  while (! pq.empty()) {
+    const SlabPixel<L> p = pq.top();
+    pq.pop();
+    if (! improves(p.distance, p.label, p.k, c.dists, c.labels)) continue;
+    c.dists[p.k] = p.distance;
+    c.labels[p.k] = p.label;
+    const mwSize z = p.k/mn;
+    if (z == sl.z0) sl.changed_lo = true;
+    if (z == sl.z1-1) sl.changed_hi = true;
+    push_slab_neighbors(pq, c, p.k, sl.z0, sl.z1);
+  }
+}
+
+// Candidates across the face between slab s (planes < zb) and slab s+1
+template <typename T, typename L>
+static void
+exchange_face(const SlabContext<T,L> &c, mwSize zb, vector< SlabPixel<L> > &to_lo, vector< SlabPixel<L> > &to_hi)
+{
+  const vector<unsigned long long> &finalized = *c.fixed;
+  const mwSize mn = c.m*c.n;
+  for (mwSize q = 0; q < mn; q++) {
+    const mwSize u = q+(zb-1)*mn, v = q+zb*mn;
+    const float w = absdiff(c.image, u, v);
+    if ((c.dists[u] < INFINITY) && (! FINALIZED(v)) && improves(c.dists[u]+w, c.labels[u], v, c.dists, c.labels))
+      to_hi.push_back(SlabPixel<L>(c.dists[u]+w, c.labels[u], v));
+    if ((c.dists[v] < INFINITY) && (! FINALIZED(u)) && improves(c.dists[v]+w, c.labels[v], u, c.dists, c.labels))
+      to_lo.push_back(SlabPixel<L>(c.dists[v]+w, c.labels[v], u));
+  }
+}
+
+template <typename T, typename L>
+static void propagate_parallel(int nthreads, int engine, double width, double max_step, const T *im_in,
+                               mxLogical *mask_in, L *labels_out,
+                               float *dists,
+                               mwSize m, mwSize n, mwSize d)
+{
+  const mwSize mn = m*n;
+  vector<unsigned long long> finalized((mn*d+63)/64, 0);
+  for (mwSize k = 0; k < mn*d; k++) {
+    dists[k] = ((labels_out[k] > 0) && mask_in[k]) ? 0 : mxGetInf();
+    if ((labels_out[k] != 0) || (! mask_in[k])) FINALIZE(k);
+  }
+  SlabContext<T,L> c;
+  c.image = im_in; c.mask = mask_in; c.labels = labels_out; c.dists = dists; c.fixed = &finalized;
+  c.m = m; c.n = n; c.d = d;
+
+  // Two slabs per thread for load balancing
+  const int nslabs = (int)((d < (mwSize)(2*nthreads)) ? d : (mwSize)(2*nthreads));
+  vector< Slab<L> > slabs(nslabs);
+  for (int s = 0; s < nslabs; s++) {
+    slabs[s].z0 = (d*s)/nslabs;
+    slabs[s].z1 = (d*(s+1))/nslabs;
+  }
+
+  bool first = true, active = true;
+  while (active) {
+    // Propagate every slab from its seeds (first run) or its improved face voxels
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (int s = 0; s < nslabs; s++) {
+      Slab<L> &sl = slabs[s];
+      if ((! first) && ((s == 0) || slabs[s-1].to_hi.empty()) && sl.to_lo.empty()) { sl.changed_lo = sl.changed_hi = false; continue; }
+      if (engine == 1) {
+        BucketQueue< SlabPixel<L>, SlabPixel_compare<L> > pq(width, max_step, SlabPixel_compare<L>());
+        if (s > 0) for (size_t t = 0; t < slabs[s-1].to_hi.size(); t++) pq.push(slabs[s-1].to_hi[t]);
+        for (size_t t = 0; t < sl.to_lo.size(); t++) pq.push(sl.to_lo[t]);
+        run_slab(pq, c, sl, first);
+      } else {
+        priority_queue< SlabPixel<L>, vector< SlabPixel<L> >, SlabPixel_compare<L> > pq;
+        if (s > 0) for (size_t t = 0; t < slabs[s-1].to_hi.size(); t++) pq.push(slabs[s-1].to_hi[t]);
+        for (size_t t = 0; t < sl.to_lo.size(); t++) pq.push(sl.to_lo[t]);
+        run_slab(pq, c, sl, first);
       }
     }
+    first = false;
+
+    // Exchange across the faces where a key changed (slab s holds the lists of its upper face)
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (int s = 0; s < nslabs-1; s++) {
+      slabs[s].to_lo.clear();
+      slabs[s].to_hi.clear();
+      if (slabs[s].changed_hi || slabs[s+1].changed_lo) exchange_face(c, slabs[s].z1, slabs[s].to_lo, slabs[s].to_hi);
+    }
+    active = false;
+    for (int s = 0; s < nslabs-1; s++) if ((! slabs[s].to_lo.empty()) || (! slabs[s].to_hi.empty())) active = true;
   }
+}
 
-  while (! pixel_queue.empty()) {
-    Pixel p = pixel_queue.top();
-    pixel_queue.pop();
-    if (! mask_in[IJ(p.i, p.j)]) continue;
-    if ((dists[IJ(p.i, p.j)] > p.distance) && (mask_in[IJ(p.i,p.j)])) {
-      dists[IJ(p.i, p.j)] = p.distance;
-      labels_out[IJ(p.i, p.j)] = p.label;
-      push_neighbors_on_queue(pixel_queue, p.distance, im_in, p.i, p.j, m, n, d, p.label, labels_out);
+template <typename T, typename L>
+static void propagate_engine(int engine, double width, int nthreads, int mode, const T *im_in,
+                             mxLogical *mask_in, L *labels_out,
+                             float *dists,
+                             mwSize m, mwSize n, mwSize d)
+{
+  const Neighbours nb(m, n);
+  const Pixel_compare<L> comp(labels_out, &nb);
+  double max_step = 0;
+  if (engine == 1) {
+    const double auto_width = calibrate_bucket_width(im_in, mask_in, m*n*d, max_step);
+    if (width <= 0) width = auto_width;
+  }
+  if ((nthreads > 1) && (mode == 1)) {
+    propagate_components(nthreads, engine, width, max_step, im_in, mask_in, labels_out, dists, m, n, d);
+  } else if ((nthreads > 1) && (d > 1)) {
+    // The distances are needed to reconcile the slabs
+    vector<float> tmp_dists;
+    if (! dists) {
+      tmp_dists.resize(m*n*d);
+      dists = &tmp_dists[0];
     }
+    propagate_parallel(nthreads, engine, width, max_step, im_in, mask_in, labels_out, dists, m, n, d);
+  } else if (engine == 1) {
+    BucketQueue< Pixel, Pixel_compare<L> > pixel_queue(width, max_step, comp);
+    propagate(pixel_queue, nb, im_in, mask_in, labels_out, dists, m, n, d);
+  } else {
+    priority_queue<Pixel, vector<Pixel>, Pixel_compare<L> > pixel_queue(comp);
+    propagate(pixel_queue, nb, im_in, mask_in, labels_out, dists, m, n, d);
   }
+}
 
+template <typename L>
+static void propagate_image(mxClassID im_class, int engine, double width, int nthreads, int mode, const void *im_in,
+                            mxLogical *mask_in, L *labels_out,
+                            float *dists,
+                            mwSize m, mwSize n, mwSize d)
+{
+  switch (im_class) {
+    case mxUINT8_CLASS:
+      propagate_engine(engine, width, nthreads, mode, (const unsigned char *)im_in, mask_in, labels_out, dists, m, n, d);
+      break;
+    case mxUINT16_CLASS:
+      propagate_engine(engine, width, nthreads, mode, (const unsigned short *)im_in, mask_in, labels_out, dists, m, n, d);
+      break;
+    case mxSINGLE_CLASS:
+      propagate_engine(engine, width, nthreads, mode, (const float *)im_in, mask_in, labels_out, dists, m, n, d);
+      break;
+    default:
+      propagate_engine(engine, width, nthreads, mode, (const double *)im_in, mask_in, labels_out, dists, m, n, d);
+      break;
+  }
 }
 
 void mexFunction( int nlhs, mxArray *plhs[], 
                   int nrhs, const mxArray*prhs[] )    
 { 
-    float *labels_in, *im_in; 
+    const void *im_in;
     mxLogical *mask_in;
-    float *labels_out, *dists;   
-    unsigned int m, n, d; 
+    void *labels_out;
+    float *dists = NULL;
+    mwSize m, n, d; 
+    mxClassID im_class, lbl_class;
+    int engine = 0;
+    double width = 0;
+    int nthreads = 1;
+    int mode = 0;
     
     // Check for proper number of arguments
-    if (nrhs != 4) { 
-        mexErrMsgTxt("Four input arguments required."); 
-    } else if (nlhs !=1 && nlhs !=2 && nlhs !=3) {
-        mexErrMsgTxt("The number of output arguments should be 1, 2, or 3."); 
+    if ((nrhs < 4) || (nrhs > 8)) { 
+        mexErrMsgTxt("Four to eight input arguments required."); 
+    } else if (nlhs !=1 && nlhs !=2) {
+        mexErrMsgTxt("The number of output arguments should be 1 or 2."); 
     } 
 
     m = mxGetM(IM_IN); 
@@ -165,11 +609,13 @@ void mexFunction( int nlhs, mxArray *plhs[],
       mexErrMsgTxt("First and third arguments must have same size.");
     }
 
-    if (! mxIsSingle(LABELS_IN)) {
-      mexErrMsgTxt("First argument must be a single array.");
+    lbl_class = mxGetClassID(LABELS_IN);
+    if ((lbl_class != mxSINGLE_CLASS) && (lbl_class != mxUINT16_CLASS) && (lbl_class != mxUINT32_CLASS)) {
+      mexErrMsgTxt("First argument must be a single, uint16 or uint32 array.");
     }
-    if (! mxIsSingle(IM_IN)) {
-      mexErrMsgTxt("Second argument must be a single array.");
+    im_class = mxGetClassID(IM_IN);
+    if ((im_class != mxUINT8_CLASS) && (im_class != mxUINT16_CLASS) && (im_class != mxSINGLE_CLASS) && (im_class != mxDOUBLE_CLASS)) {
+      mexErrMsgTxt("Second argument must be a uint8, uint16, single or double array.");
     }
     if (! mxIsLogical(MASK_IN)) {
       mexErrMsgTxt("Third argument must be a logical array.");
@@ -178,29 +624,41 @@ void mexFunction( int nlhs, mxArray *plhs[],
       mexErrMsgTxt("Fourth argument must be a single.");
     }
 
-    // Create matrices for the return arguments 
-    //LABELS_OUT = mxCreateSingleMatrix(m, n, mxREAL);
-    LABELS_OUT = mxCreateNumericMatrix(m, n, mxSINGLE_CLASS, mxREAL);
-    //DISTANCES_OUT = mxCreateSingleMatrix(m, n, mxREAL);
-    DISTANCES_OUT = mxCreateNumericMatrix(m, n, mxSINGLE_CLASS, mxREAL);
+    // Create matrices for the return arguments (labels are propagated in the copy of the seeds)
+    LABELS_OUT = mxDuplicateArray(LABELS_IN);
+    if (nlhs > 1) {
+      DISTANCES_OUT = mxCreateNumericMatrix(m, n, mxSINGLE_CLASS, mxREAL);
+      dists = (float *)mxGetData(DISTANCES_OUT);
+    }
 
     // Assign pointers to the various parameters 
-    labels_in = (float *)mxGetData(LABELS_IN);
-    im_in = (float *)mxGetData(IM_IN);
+    im_in = mxGetData(IM_IN);
     mask_in = mxGetLogicals(MASK_IN);
-    d = (int)mxGetScalar(NPLANES_IN);
+    d = (mwSize)mxGetScalar(NPLANES_IN);
     n = n/d;
-	  labels_out = (float *)mxGetData(LABELS_OUT);
-
-    // Do the actual computations in a subroutine
-    dists = (float *)mxGetData(DISTANCES_OUT);
+    if (nrhs > 4) engine = (int)mxGetScalar(ENGINE_IN);
+    if (nrhs > 5) width = mxGetScalar(WIDTH_IN);
+    if (nrhs > 6) nthreads = (int)mxGetScalar(NTHREADS_IN);
+    if (nrhs > 7) mode = (int)mxGetScalar(MODE_IN);
+    labels_out = mxGetData(LABELS_OUT);
 
 	// Debug
 	//mexPrintf("rows: %i\n", m);
 	//mexPrintf("cols: %i\n", n);
 	//mexPrintf("plns: %i\n", d);	
 	
-    propagate(labels_in, im_in, mask_in, labels_out, dists, m, n, d); 
+    // Do the actual computations in a subroutine
+    switch (lbl_class) {
+      case mxUINT16_CLASS:
+        propagate_image(im_class, engine, width, nthreads, mode, im_in, mask_in, (unsigned short *)labels_out, dists, m, n, d);
+        break;
+      case mxUINT32_CLASS:
+        propagate_image(im_class, engine, width, nthreads, mode, im_in, mask_in, (unsigned int *)labels_out, dists, m, n, d);
+        break;
+      default:
+        propagate_image(im_class, engine, width, nthreads, mode, im_in, mask_in, (float *)labels_out, dists, m, n, d);
+        break;
+    }
     
     return;
-}
\ No newline at end of file
+}
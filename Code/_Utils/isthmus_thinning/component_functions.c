@@ -0,0 +1,209 @@
+/*******************************************************************************
+*
+*       Name:                component_functions.c
+*
+*       Thinning of a volume component by component: the object voxels only
+*       interact with their 26-neighbours, so every 26-connected component can
+*       be thinned on its own in a cropped sub-volume (bounding box + 1 voxel
+*       frame) with the same result as the whole volume. The components are
+*       held as runs of voxels along x: memory and scan time of the thinning
+*       then scale with the components, not with the stack.
+*
+*******************************************************************************/
+
+static int compare_components(const void *a, const void *b)
+{
+  const Component *ca = (const Component *)a, *cb = (const Component *)b;
+  if ( ca->voxels != cb->voxels ) return ( ca->voxels < cb->voxels ) ? 1 : -1;
+  return ( ca->first < cb->first ) ? -1 : ( ca->first > cb->first );
+}
+
+#define VISITED(v, w, x)   ( (v)[(w) + ((x)>>6)] & ( 1ULL<<((x)&63) ) )
+
+/* append the maximal run of object voxels of row r (image row row) holding
+   voxel x to the run list and mark it visited (bit rows, w: first word of
+   the row). Returns 0 if the list cannot grow (the list is unchanged) */
+static int push_run(Run **runs, unsigned long int *length, unsigned long int *capacity,
+                    const unsigned char *r, unsigned long long *visited, unsigned long int w,
+                    unsigned long int row, unsigned long int x, unsigned long int size_x)
+{
+Run *list = *runs;
+
+  if ( *length == *capacity )
+    {
+      list = (Run *)realloc(list, 2*(*capacity)*sizeof(Run));
+      if ( list == NULL ) return 0;
+      *capacity *= 2;
+      *runs = list;
+    }
+  while ( ( x > 0 ) && r[x-1] ) x--;
+  list[*length].start = row*size_x + x;
+  for ( ; ( x < size_x ) && r[x]; x++ ) visited[w + (x>>6)] |= 1ULL<<(x&63);
+  list[*length].length = row*size_x + x - list[*length].start;
+  (*length)++;
+  return 1;
+}
+
+/*========= function find_components =========*/
+/* 26-connected components of the object voxels (non zero) of the image given
+   by its rows (row y + z*size_y: rows[y + z*size_y][0 .. size_x-1]), runs
+   grouped by component in *runs (breadth first order, image linear indices).
+   Only a bit per voxel is allocated to mark the visited voxels.
+   Returns the number of components, *comps is sorted by decreasing size.
+   Main thread only: an allocation failure frees the buffers and raises the
+   error (ALLOC_ERROR). */
+unsigned long int find_components(const unsigned char * const *rows,
+                                  unsigned long int size_x, unsigned long int size_y,
+                                  unsigned long int size_z,
+                                  Run **runs, Component **comps)
+{
+unsigned long int nrows = size_y*size_z, wpr = (size_x+63)/64;
+unsigned long int k, row, nrow, head, tail, x0, x1, x, y, z, ncomps = 0, rcap = 1024, ccap = 64;
+long int dy, dz;
+unsigned long long *visited;
+const unsigned char *r;
+Run *list;
+Component *c, *table, *grown;
+
+  list    = (Run *)malloc(rcap*sizeof(Run));
+  table   = (Component *)malloc(ccap*sizeof(Component));
+  visited = (unsigned long long *)calloc(nrows*wpr > 0 ? nrows*wpr : 1, sizeof(unsigned long long));
+  if ( ( list == NULL ) || ( table == NULL ) || ( visited == NULL ) ) goto alloc_error;
+
+  tail = 0;
+  for ( row=0; row<nrows; row++ )
+    for ( k=0, r=rows[row]; k<size_x; k++ )
+      {
+        if ( ( r[k] == 0 ) || VISITED(visited, row*wpr, k) ) continue;
+        if ( ncomps == ccap )
+          {
+            grown = (Component *)realloc(table, 2*ccap*sizeof(Component));
+            if ( grown == NULL ) goto alloc_error;
+            ccap *= 2;
+            table = grown;
+          }
+        c = table + ncomps++;
+        c->first  = tail;
+        c->voxels = 0;
+        c->box[0] = size_x; c->box[1] = size_y; c->box[2] = size_z;
+        c->box[3] = c->box[4] = c->box[5] = 0;
+
+        /* breadth first fill, the component run list is the queue: the
+           neighbours of a run are in the 8 neighbouring rows, from x0-1 to x1+1 */
+        if ( ! push_run(&list, &tail, &rcap, r, visited, row*wpr, row, k, size_x) ) goto alloc_error;
+        for ( head = c->first; head < tail; head++ )
+          {
+            nrow = list[head].start / size_x;
+            x0   = list[head].start - nrow*size_x;
+            x1   = x0 + list[head].length - 1;
+            y    = nrow % size_y;
+            z    = nrow / size_y;
+            c->voxels += list[head].length;
+            if ( x0 < c->box[0] ) c->box[0] = x0;
+            if ( y  < c->box[1] ) c->box[1] = y;
+            if ( z  < c->box[2] ) c->box[2] = z;
+            if ( x1 > c->box[3] ) c->box[3] = x1;
+            if ( y  > c->box[4] ) c->box[4] = y;
+            if ( z  > c->box[5] ) c->box[5] = z;
+            if ( x0 > 0 ) x0--;
+            if ( x1 < size_x-1 ) x1++;
+            for ( dz=-1; dz<=1; dz++ )
+              {
+                if ( ( ( dz < 0 ) && ( z == 0 ) ) || ( ( dz > 0 ) && ( z == size_z-1 ) ) ) continue;
+                for ( dy=-1; dy<=1; dy++ )
+                  {
+                    if ( ( ( dy < 0 ) && ( y == 0 ) ) || ( ( dy > 0 ) && ( y == size_y-1 ) ) ) continue;
+                    if ( ( dy == 0 ) && ( dz == 0 ) ) continue;   /* the run is maximal */
+                    nrow = list[head].start / size_x + dy + dz*(long int)size_y;
+                    for ( x=x0; x<=x1; x++ )
+                      if ( rows[nrow][x] && ! VISITED(visited, nrow*wpr, x) )
+                        {
+                          if ( ! push_run(&list, &tail, &rcap, rows[nrow], visited, nrow*wpr, nrow, x, size_x) )
+                            goto alloc_error;
+                          x = list[tail-1].start + list[tail-1].length - nrow*size_x;
+                        }
+                  }
+              }
+          }
+        c->count = tail - c->first;
+      }
+
+  free(visited);
+  qsort(table, ncomps, sizeof(Component), compare_components);
+  *runs  = list;
+  *comps = table;
+  return ncomps;
+
+alloc_error:
+  free(list);
+  free(table);
+  free(visited);
+  ALLOC_ERROR();
+  return 0;
+}
+/*========= end of function find_components =========*/
+
+/*========= function thin_component =========*/
+/* copy the runs of the component to a cropped volume (object voxels set to
+   1), thin it (mode 0: sequential, 1: subfield with nthreads) and write the
+   thinned runs back to the rows of out, or append the linear indices of the
+   skeleton voxels to skeleton if out is NULL.
+   The crop is framed even where the component touches the border of the
+   image, it starts on even coordinates so that the subfields are unchanged.
+   Safe in parallel threads: returns 0 on an allocation failure (nothing is
+   written to out), the caller raises the error from the main thread. */
+int thin_component(const Component *c, const Run *runs,
+                   unsigned char * const *out, SurfaceList *skeleton,
+                   unsigned long int size_x, unsigned long int size_y,
+                   const unsigned char *lut_simple, const unsigned char *lut_isthmus,
+                   int mode, int nthreads)
+{
+long int lo[3];
+unsigned long int cx, cy, cz, cxy, i, k, l, x, row;
+unsigned char *crop;
+ThinningContext ctx;
+
+  for ( i=0; i<3; i++ ) lo[i] = ( (long int)c->box[i] - 1 ) & ~1L;
+  cx = c->box[3] + 2 - lo[0];
+  cy = c->box[4] + 2 - lo[1];
+  cz = c->box[5] + 2 - lo[2];
+  cxy = cx*cy;
+  crop = (unsigned char *)calloc(cxy*cz, sizeof(unsigned char));
+  if ( crop == NULL ) return 0;
+
+  for ( i=c->first; i<c->first+c->count; i++ )
+    {
+      row = runs[i].start / size_x;
+      x = runs[i].start - row*size_x;
+      l = ( x - lo[0] ) + ( row % size_y - lo[1] )*cx + ( row / size_y - lo[2] )*cxy;
+      memset(crop + l, 1, runs[i].length);
+    }
+
+  init_thinning_context(&ctx, crop, cx, cy, cz, lut_simple, lut_isthmus);
+  if ( mode == 1 ) subfield_thinning(&ctx, nthreads);
+  else sequential_thinning(&ctx);
+  if ( ctx.failed )
+    {
+      free(crop);
+      return 0;
+    }
+
+  for ( i=c->first; i<c->first+c->count; i++ )
+    {
+      row = runs[i].start / size_x;
+      x = runs[i].start - row*size_x;
+      l = ( x - lo[0] ) + ( row % size_y - lo[1] )*cx + ( row / size_y - lo[2] )*cxy;
+      if ( out != NULL )
+        memcpy(out[row] + x, crop + l, runs[i].length);
+      else
+        for ( k=0; k<runs[i].length; k++ )
+          if ( crop[l + k] && ! AppendVoxel(skeleton, runs[i].start + k) )
+            {
+              free(crop);
+              return 0;
+            }
+    }
+  free(crop);
+  return 1;
+}
+/*========= end of function thin_component =========*/
@@ -0,0 +1,289 @@
+/*******************************************************************************
+*
+*       Name:                graph_functions.c
+*
+*       Skeleton to graph conversion with the conventions of Skel2Graph3D
+*       (same nodes, links and ordering), computed from the 26-neighbourhood
+*       codes of the bit rows used by the thinning. Per voxel data is only
+*       held for the skeleton voxels (indexed by their rank in the bit rows).
+*       Only used by the skeletongraph MEX file (main thread): the memory is
+*       allocated with the MATLAB memory manager, an allocation failure raises
+*       a MATLAB error and the memory is released by MATLAB.
+*
+*******************************************************************************/
+
+static void *graph_alloc(unsigned long int n, size_t size)
+{
+  return mxMalloc(( n > 0 ? n : 1 )*size);
+}
+
+static unsigned long int *graph_grow(unsigned long int *a, unsigned long int *capacity,
+                                     unsigned long int needed)
+{
+  if ( needed <= *capacity ) return a;
+  while ( *capacity < needed ) *capacity *= 2;
+  return (unsigned long int *)mxRealloc(a, *capacity*sizeof(unsigned long int));
+}
+
+/*========= function init_skeleton_graph =========*/
+/* empty skeleton of size m x n x d (framed in the bit rows) */
+void init_skeleton_graph(SkeletonGraph *g, unsigned long int m,
+                         unsigned long int n, unsigned long int d)
+{
+unsigned long int i = 0;
+long int dx, dy, dz;
+
+  memset(g, 0, sizeof(SkeletonGraph));
+  init_thinning_context(&g->ctx, NULL, m+2, n+2, d+2, NULL, NULL);
+  g->ctx.bits = (unsigned long long *)mxCalloc(g->ctx.size_y*g->ctx.size_z*g->ctx.words_per_row,
+                                               sizeof(unsigned long long));
+  for ( dz=-1; dz<=1; dz++ )
+    for ( dy=-1; dy<=1; dy++ )
+      for ( dx=-1; dx<=1; dx++ )
+        if ( dx || dy || dz )
+          g->offset[i++] = dx + dy*(long int)g->ctx.size_x + dz*(long int)g->ctx.size_xy;
+}
+/*========= end of function init_skeleton_graph =========*/
+
+/* set voxel (x,y,z) of the skeleton (unframed coordinates) */
+void add_skeleton_voxel(SkeletonGraph *g, unsigned long int x,
+                        unsigned long int y, unsigned long int z)
+{
+unsigned long int row = (y+1) + (z+1)*g->ctx.size_y;
+  g->ctx.bits[row*g->ctx.words_per_row + ((x+1)>>6)] |= 1ULL<<((x+1)&63);
+}
+
+static unsigned long int voxel_rank(const SkeletonGraph *g, unsigned long int k)
+{
+unsigned long int row = k / g->ctx.size_x, x = k - row*g->ctx.size_x;
+unsigned long int w = row*g->ctx.words_per_row + (x>>6);
+  return g->rank_base[w] + bit_count(g->ctx.bits[w] & ((1ULL<<(x&63)) - 1));
+}
+
+/* ranks of the 26-neighbours of voxel of rank v, in increasing order */
+static int neighbour_ranks(const SkeletonGraph *g, unsigned long int v, unsigned long int *nb)
+{
+unsigned long int k = g->voxel[v];
+unsigned long long code = neighbourhood_code(&g->ctx, k);
+int n = 0, b;
+  while ( code )
+    {
+      b = lowest_bit(code);
+      code &= code-1;
+      nb[n++] = voxel_rank(g, k + g->offset[b]);
+    }
+  return n;
+}
+
+static int compare_ranks(const void *a, const void *b)
+{
+  unsigned long int ra = *(const unsigned long int *)a, rb = *(const unsigned long int *)b;
+  return ( ra > rb ) - ( ra < rb );
+}
+
+/* breadth first fill from voxel v over the voxels of class cls (any class
+   if cls < 0) not yet labelled, appends the voxels to queue */
+static unsigned long int fill_cluster(const SkeletonGraph *g, unsigned long int v, int cls,
+                                      unsigned long int *mark, unsigned long int value,
+                                      unsigned long int *queue, unsigned long int tail)
+{
+unsigned long int head = tail, nb[26];
+int i, n;
+  mark[v] = value;
+  queue[tail++] = v;
+  for ( ; head < tail; head++ )
+    {
+      n = neighbour_ranks(g, queue[head], nb);
+      for ( i=0; i<n; i++ )
+        if ( ( mark[nb[i]] == 0 ) && ( ( cls < 0 ) || ( g->cls[nb[i]] == cls ) ) )
+          {
+            mark[nb[i]] = value;
+            queue[tail++] = nb[i];
+          }
+    }
+  return tail;
+}
+
+/*========= function follow_link =========*/
+/* follow the link voxels from voxel v of a node through link voxel c until a
+   node is reached (pk_follow_link), the voxels are appended to the points.
+   Returns the node reached, or -1 (points not appended) if the chain is broken */
+static long int follow_link(SkeletonGraph *g, unsigned long int v, unsigned long int c)
+{
+unsigned long int prev = v, next, nb[26], steps = 0;
+  g->points = graph_grow(g->points, &g->point_capacity, g->npoints+2);
+  g->points[g->npoints] = v;
+  while ( steps++ <= g->nvoxels )
+    {
+      if ( ( g->cls[c] != 2 ) || ( neighbour_ranks(g, c, nb) != 2 ) ) return -1;
+      next = ( nb[0] == prev ) ? nb[1] : nb[0];
+      g->points = graph_grow(g->points, &g->point_capacity, g->npoints+steps+2);
+      g->points[g->npoints+steps] = c;
+      if ( g->state[next] > 1 )
+        {
+          g->points[g->npoints+steps+1] = next;
+          g->npoints += steps+2;
+          return (long int)(g->state[next] - 2);
+        }
+      prev = c;
+      c = next;
+    }
+  return -1;
+}
+/*========= end of function follow_link =========*/
+
+static void add_link(SkeletonGraph *g, unsigned long int n1, unsigned long int n2,
+                     unsigned long int first)
+{
+  if ( g->nlinks+1 >= g->link_capacity )
+    {
+      g->link_capacity *= 2;
+      g->link_n1    = (unsigned long int *)mxRealloc(g->link_n1, g->link_capacity*sizeof(unsigned long int));
+      g->link_n2    = (unsigned long int *)mxRealloc(g->link_n2, g->link_capacity*sizeof(unsigned long int));
+      g->link_first = (unsigned long int *)mxRealloc(g->link_first, g->link_capacity*sizeof(unsigned long int));
+    }
+  g->link_n1[g->nlinks] = n1;
+  g->link_n2[g->nlinks] = n2;
+  g->link_first[g->nlinks] = first;
+  g->nlinks++;
+  g->link_first[g->nlinks] = g->npoints;
+}
+
+/*========= function build_skeleton_graph =========*/
+/* nodes and links of the skeleton set by add_skeleton_voxel, links to an end
+   node must be longer than thr voxels (single voxel links kept if thr is 0) */
+void build_skeleton_graph(SkeletonGraph *g, double thr)
+{
+unsigned long int nwords = g->ctx.size_y*g->ctx.size_z*g->ctx.words_per_row;
+unsigned long int w, v, i, j, tail, first, nb[26], cand[26], ends[26];
+unsigned long int *queue, *mark;
+unsigned long long word;
+long int reached;
+int b, n, c, ncand, nends, cls;
+
+  /* voxel ranks */
+  g->rank_base = (unsigned long int *)graph_alloc(nwords+1, sizeof(unsigned long int));
+  g->rank_base[0] = 0;
+  for ( w=0; w<nwords; w++ )
+    g->rank_base[w+1] = g->rank_base[w] + bit_count(g->ctx.bits[w]);
+  g->nvoxels = g->rank_base[nwords];
+  g->voxel = (unsigned long int *)graph_alloc(g->nvoxels, sizeof(unsigned long int));
+  for ( w=0, v=0; w<nwords; w++ )
+    for ( word = g->ctx.bits[w]; word; word &= word-1 )
+      g->voxel[v++] = (w / g->ctx.words_per_row)*g->ctx.size_x +
+                      ((w % g->ctx.words_per_row)<<6) + lowest_bit(word);
+
+  /* voxel classes */
+  g->cls = (unsigned char *)graph_alloc(g->nvoxels, sizeof(unsigned char));
+  for ( v=0; v<g->nvoxels; v++ )
+    {
+      b = bit_count((unsigned long long)neighbourhood_code(&g->ctx, g->voxel[v]));
+      g->cls[v] = (unsigned char)( ( b > 2 ) ? 3 : b );
+    }
+
+  /* skeleton components */
+  queue = (unsigned long int *)graph_alloc(g->nvoxels, sizeof(unsigned long int));
+  g->label = (unsigned long int *)mxCalloc(g->nvoxels > 0 ? g->nvoxels : 1, sizeof(unsigned long int));
+  mark = (unsigned long int *)mxCalloc(g->nvoxels > 0 ? g->nvoxels : 1, sizeof(unsigned long int));
+  for ( v=0, i=0; v<g->nvoxels; v++ )
+    if ( g->label[v] == 0 ) fill_cluster(g, v, -1, g->label, ++i, queue, 0);
+
+  /* nodes: clusters of branch voxels then clusters of end voxels, voxels
+     in increasing order */
+  g->node_first = (unsigned long int *)graph_alloc(g->nvoxels+1, sizeof(unsigned long int));
+  g->node_vox = queue;
+  g->state = (unsigned long int *)graph_alloc(g->nvoxels, sizeof(unsigned long int));
+  for ( v=0; v<g->nvoxels; v++ ) g->state[v] = 1;
+  tail = 0;
+  for ( cls=3; cls>=1; cls-=2 )
+    {
+      for ( v=0; v<g->nvoxels; v++ )
+        {
+          if ( ( g->cls[v] != cls ) || mark[v] ) continue;
+          first = tail;
+          tail = fill_cluster(g, v, cls, mark, 1, queue, tail);
+          qsort(queue + first, tail - first, sizeof(unsigned long int), compare_ranks);
+          for ( j=first; j<tail; j++ ) g->state[queue[j]] = g->nnodes + 2;
+          g->node_first[g->nnodes++] = first;
+        }
+      if ( cls == 3 ) g->nbranch = g->nnodes;
+    }
+  g->node_first[g->nnodes] = tail;
+  mxFree(mark);
+  g->node_ep = (unsigned char *)graph_alloc(g->nnodes, sizeof(unsigned char));
+  for ( i=0; i<g->nnodes; i++ ) g->node_ep[i] = ( i >= g->nbranch );
+
+  /* links: from every voxel of every node, the unvisited link voxels
+     (in increasing order) then the end voxels next to it */
+  g->link_capacity = 64;
+  g->link_n1    = (unsigned long int *)graph_alloc(g->link_capacity, sizeof(unsigned long int));
+  g->link_n2    = (unsigned long int *)graph_alloc(g->link_capacity, sizeof(unsigned long int));
+  g->link_first = (unsigned long int *)graph_alloc(g->link_capacity, sizeof(unsigned long int));
+  g->link_first[0] = 0;
+  g->point_capacity = 1024;
+  g->points = (unsigned long int *)graph_alloc(g->point_capacity, sizeof(unsigned long int));
+  for ( i=0; i<g->nnodes; i++ )
+    for ( j=g->node_first[i]; j<g->node_first[i+1]; j++ )
+      {
+        v = g->node_vox[j];
+        n = neighbour_ranks(g, v, nb);
+        ncand = nends = 0;
+        for ( b=0; b<n; b++ )
+          {
+            if ( ( g->state[nb[b]] == 1 ) && ( g->cls[nb[b]] == 2 ) ) cand[ncand++] = nb[b];
+            if ( g->cls[nb[b]] == 1 ) ends[nends++] = nb[b];
+          }
+        for ( c=0; c<ncand; c++ )
+          {
+            first = g->npoints;
+            reached = follow_link(g, v, cand[c]);
+            if ( reached < 0 ) continue;
+            for ( w=first+1; w<g->npoints-1; w++ ) g->state[g->points[w]] = 0;
+            if ( ( g->node_ep[reached] && ( (double)(g->npoints - first) > thr ) ) ||
+                 ( ! g->node_ep[reached] && ( (unsigned long int)reached != i ) ) )
+              add_link(g, i, (unsigned long int)reached, first);
+            else
+              g->npoints = first;
+          }
+        if ( thr == 0 )
+          for ( c=0; c<nends; c++ )
+            if ( ( g->state[ends[c]] > 1 ) && ( g->state[ends[c]] - 2 != i ) )
+              {
+                first = g->npoints;
+                g->points = graph_grow(g->points, &g->point_capacity, first+1);
+                g->points[g->npoints++] = ends[c];
+                add_link(g, i, g->state[ends[c]] - 2, first);
+                g->state[ends[c]] = 0;
+              }
+      }
+
+  /* links of every node (a link is listed at n1 then at n2), nodes with a
+     single link are end nodes */
+  g->node_link_first = (unsigned long int *)mxCalloc(g->nnodes+1, sizeof(unsigned long int));
+  g->node_links = (unsigned long int *)graph_alloc(2*g->nlinks, sizeof(unsigned long int));
+  for ( j=0; j<g->nlinks; j++ )
+    {
+      g->node_link_first[g->link_n1[j]+1]++;
+      g->node_link_first[g->link_n2[j]+1]++;
+    }
+  for ( i=0; i<g->nnodes; i++ ) g->node_link_first[i+1] += g->node_link_first[i];
+  mark = (unsigned long int *)graph_alloc(g->nnodes, sizeof(unsigned long int));
+  memcpy(mark, g->node_link_first, g->nnodes*sizeof(unsigned long int));
+  for ( j=0; j<g->nlinks; j++ )
+    {
+      g->node_links[mark[g->link_n1[j]]++] = j;
+      g->node_links[mark[g->link_n2[j]]++] = j;
+    }
+  mxFree(mark);
+  for ( i=0; i<g->nnodes; i++ )
+    if ( g->node_link_first[i+1] - g->node_link_first[i] == 1 ) g->node_ep[i] = 1;
+}
+/*========= end of function build_skeleton_graph =========*/
+
+void free_skeleton_graph(SkeletonGraph *g)
+{
+  mxFree(g->ctx.bits);
+  mxFree(g->rank_base); mxFree(g->voxel); mxFree(g->cls); mxFree(g->state); mxFree(g->label);
+  mxFree(g->node_first); mxFree(g->node_vox); mxFree(g->node_link_first); mxFree(g->node_links);
+  mxFree(g->node_ep); mxFree(g->link_n1); mxFree(g->link_n2); mxFree(g->link_first); mxFree(g->points);
+}
@@ -13,80 +13,115 @@
   #include <math.h>
   #include "ibcenterline.h"
 
-/* global variables */
-  long int           long_mask[26];
-  unsigned char      char_mask[8];
-  unsigned long int  neighbours;
-  unsigned long int  direction;
-  unsigned char      *lut_simple;
-  unsigned char      *lut_isthmus;
-  unsigned long int  size_x;
-  unsigned long int  size_y;
-  unsigned long int  size_z;
-  unsigned long int  size_xy;
-  unsigned long int  size_xyz;
-  unsigned long int  z_size_xy, zm_size_xy, zp_size_xy;
-  unsigned long int  y_size_x, ym_size_x, yp_size_x;
-  analyze_hdr        hdr;
-  unsigned char      *image;
-  Bordercell *borderlist;
-  List SurfaceVoxels;
-
  #include "readwrite_functions.c"
  #include "thinning_functions.c" 
+ #include "component_functions.c"
+
+/* has name the extension ext (case insensitive) */
+static int has_extension( const char *name, const char *ext )
+{
+  size_t ln = strlen(name), le = strlen(ext), i;
+    if ( ln < le ) return 0;
+    for ( i=0; i<le; i++ )
+      if ( ( name[ln-le+i] | 0x20 ) != ( ext[i] | 0x20 ) ) return 0;
+    return 1;
+}
   
 /*===========================================================================
     function    m a i n
   ===========================================================================*/
 int main(int argc, char *argv[])
   {
+    analyze_hdr        hdr;
+    unsigned char      *lut_simple, *lut_isthmus;
+    unsigned long int  ncomps, c, num, raw[3] = {0, 0, 0};
+    MappedVolume       vol;
+    Run                *runs;
+    Component          *comps;
+    SurfaceList        skeleton = { NULL, 0, 0, 0 };
+    int                i, list = 0, usage = ( argc < 3 );
 
   /**********************/
   /* PARAMETER CHECKING */
   /**********************/
-    if ( ! (argc==3) )
+    for ( i=3; ( i<argc ) && ! usage; i++ )
+      {
+        if ( ! strcmp(argv[i], "-list") ) list = 1;
+        else if ( ! strcmp(argv[i], "-raw") && ( i+3 < argc ) )
+          {
+            raw[0] = strtoul(argv[++i], NULL, 10);
+            raw[1] = strtoul(argv[++i], NULL, 10);
+            raw[2] = strtoul(argv[++i], NULL, 10);
+            usage = ( raw[0] == 0 ) || ( raw[1] == 0 ) || ( raw[2] == 0 );
+          }
+        else usage = 1;
+      }
+    if ( usage )
       {
         printf("\n USAGE:                                                   ");
-        printf("\n   %s   inpname   outname ",argv[0]                        );
+        printf("\n   %s   inpname   outname  [-raw X Y Z]  [-list]",argv[0]  );
         printf("\n   where: - inpname  :   name of the input image          ");
         printf("\n                         containing the image data        ");
-	printf("\n                         (without extension)              ");
+	printf("\n                         (Analyze: without extension,     ");
+        printf("\n                         .tif: uncompressed 8 bit TIFF,   ");
+        printf("\n                         -raw: 8 bit raw of size X Y Z)   ");
         printf("\n          - outname  :   name of the output image         ");
         printf("\n                         storing the centerlines          ");
         printf("\n                         (without extension)              ");
+        printf("\n          - -list    :   write the centerline voxels      ");
+        printf("\n                         (x y z) to outname.txt           ");
         printf("\n\n");
         exit(0);
       } /* endif */
 
 
-  /********************/
-  /* READ INPUT IMAGE */
-  /********************/
-    read_image( argv[1] );
+  /*******************/
+  /* MAP INPUT IMAGE */
+  /*******************/
+    if ( raw[0] ) map_raw( argv[1], raw[0], raw[1], raw[2], &vol );
+    else if ( has_extension(argv[1], ".tif") || has_extension(argv[1], ".tiff") ) map_tiff( argv[1], &vol );
+    else map_analyze( argv[1], &hdr, &vol );
+    if ( raw[0] || ( has_extension(argv[1], ".tif") || has_extension(argv[1], ".tiff") ) )
+      make_analyze_hdr( &hdr, vol.size_x, vol.size_y, vol.size_z );
+    printf("\n Size of the input image: %lu, %lu, %lu\n", vol.size_x, vol.size_y, vol.size_z);
+
+  /**************/
+  /* COMPONENTS */
+  /**************/
+    ncomps = find_components( vol.rows, vol.size_x, vol.size_y, vol.size_z, &runs, &comps );
+    for ( c=0, num=0; c<ncomps; c++ ) num += comps[c].voxels;
+    printf("\n Number of object points in the original image: %lu\n", num);
 
   /****************/
   /* READING LUTs */
   /****************/
-    init_lut_simple();
-    init_lut_isthmus();
+    lut_simple  = init_lut_simple();
+    lut_isthmus = init_lut_isthmus();
     
   /************/  
   /* THINNING */
   /************/
     printf("\n Centerline extraction by sequential isthmus-based thinning ...");
-    sequential_thinning();
+    for ( c=0; c<ncomps; c++ )
+      if ( ! thin_component( &comps[c], runs, NULL, &skeleton, vol.size_x, vol.size_y,
+                             lut_simple, lut_isthmus, 0, 1 ) )
+        ALLOC_ERROR();
     
   /********************/
   /* WRITE OUPUT IMAGE */
   /********************/
-    write_image( argv[2] );
+    if ( list ) write_skeleton_list( argv[2], &skeleton, vol.size_x, vol.size_y, vol.size_z );
+    else write_skeleton( argv[2], &hdr, &skeleton, vol.size_x, vol.size_y, vol.size_z );
   
   /********/  
   /* FREE */
   /********/
     free(lut_simple);
     free(lut_isthmus);    
-    free(image);
+    free(runs);
+    free(comps);
+    free(skeleton.voxel);
+    unmap_volume(&vol);
 
     printf("\n");	
 
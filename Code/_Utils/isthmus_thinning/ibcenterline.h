@@ -33,39 +33,91 @@
         char            pad7[120];
   } analyze_hdr;
 
-  typedef struct {
-        unsigned long int x,y,z;
-        void *next;
-        void *prev;
-  } ListElement;
-
-  typedef struct {
-        void *first;
-        void *last;
-  } List;
- 
   typedef struct {
         long i, j, k;
   } Voxel;
 
+  /* surface voxels: linear indices in insertion order, deleted entries are
+     tombstoned (REMOVED) and squeezed out once they outnumber the live ones */
+  #define REMOVED            ((unsigned long int)-1)
   typedef struct {
-        Voxel v;
-        ListElement * ptr;
-        void *next;
-  } Cell;
-
-  typedef struct {
-        Cell *Head;
-        Cell *Tail;
-        int Length;
-  } PointList;
+        unsigned long int *voxel;
+        unsigned long int length, capacity, removed;
+  } SurfaceList;
 
+  /* simple border points of the current direction: positions in the surface
+     list, the buffer is reused from one direction to the next */
   typedef struct {
-        ListElement *first;
-        ListElement *last;
-  } DoubleList;
+        unsigned long int *pos;
+        unsigned long int length, capacity;
+  } CandidateList;
 
   typedef struct {
         unsigned long int x, y, z;
         void             *next;
   } Bordercell; 
+
+  /* thinning context: everything a thinning run reads and writes, so that
+     several volumes can be thinned concurrently (one context per volume) */
+  typedef struct {
+        unsigned char       *image;       /* framed volume: 0 background, 1 object,
+                                             2 surface voxel, 3 isthmus */
+        unsigned long int   size_x, size_y, size_z;
+        unsigned long int   size_xy, size_xyz;
+        const unsigned char *lut_simple;  /* shared, read-only */
+        const unsigned char *lut_isthmus; /* shared, read-only */
+        SurfaceList         SurfaceVoxels;
+        CandidateList       Candidates;
+        unsigned long long  *bits;        /* object voxels (image != 0) packed along x,
+                                             one bit row per (y,z) row of the image */
+        unsigned long int   words_per_row;
+        unsigned long int   neighbours;   /* 26-neighbourhood code of the current voxel */
+        unsigned long int   direction;    /* current deletion direction */
+        int                 failed;       /* allocation failure: the thinning stopped,
+                                             the image is incomplete */
+  } ThinningContext;
+
+  /* run of object voxels along x: image[start .. start+length-1] */
+  typedef struct {
+        unsigned long int start, length;
+  } Run;
+
+  /* 26-connected object component: runs[first .. first+count-1] of the
+     component run list, number of voxels, bounding box box[0..2] (min x,y,z)
+     to box[3..5] (max x,y,z) */
+  typedef struct {
+        unsigned long int first, count, voxels;
+        unsigned long int box[6];
+  } Component;
+
+  /* input image mapped in memory (standalone program): row y + z*size_y of
+     the image is rows[y + z*size_y][0 .. size_x-1] */
+  typedef struct {
+        unsigned long int    size_x, size_y, size_z;
+        const unsigned char  **rows;
+        const unsigned char  *data;       /* mapped file */
+        size_t               length;
+  } MappedVolume;
+
+  /* skeleton graph (Skel2Graph3D conventions): the skeleton voxels are
+     numbered by rank in the bit rows of the framed skeleton (linear order),
+     the nodes are the clusters of branch voxels then the clusters of end
+     voxels, the links join two nodes through link voxels */
+  typedef struct {
+        ThinningContext     ctx;          /* bit rows of the framed skeleton */
+        long int            offset[26];   /* neighbour offsets, neighbourhood code order */
+        unsigned long int   *rank_base;   /* number of voxels before each word of the bit rows */
+        unsigned long int   nvoxels;
+        unsigned long int   *voxel;       /* framed index of each voxel */
+        unsigned char       *cls;         /* 0: isolated, 1: end, 2: link, 3: branch voxel */
+        unsigned long int   *state;       /* 0: visited link voxel, 1: link voxel, n+2: voxel of node n */
+        unsigned long int   *label;       /* 26-connected component of the skeleton (from 1) */
+        unsigned long int   nnodes, nbranch;            /* the first nbranch nodes are branch nodes */
+        unsigned long int   *node_first, *node_vox;     /* voxels of node n: node_vox[node_first[n] .. node_first[n+1]-1] */
+        unsigned long int   *node_link_first, *node_links; /* links of node n, in the same way */
+        unsigned char       *node_ep;
+        unsigned long int   nlinks, link_capacity;
+        unsigned long int   *link_n1, *link_n2, *link_first; /* points of link l: points[link_first[l] .. link_first[l+1]-1] */
+        unsigned long int   npoints, point_capacity;
+        unsigned long int   *points;
+  } SkeletonGraph;
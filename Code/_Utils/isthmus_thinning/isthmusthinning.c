@@ -5,70 +5,95 @@
   #include <math.h>
   #include <mex.h>
   #include "ibcenterline.h"
+  #ifdef _OPENMP
+  #include <omp.h>
+  #endif
   #include "matrix.h"
 
-/* global variables */
-  long int           long_mask[26];
-  unsigned char      char_mask[8];
-  unsigned long int  neighbours;
-  unsigned long int  direction;
-  unsigned char      *lut_simple;
-  unsigned char      *lut_isthmus;
-  unsigned long int  size_x;
-  unsigned long int  size_y;
-  unsigned long int  size_z;
-  unsigned long int  size_xy;
-  unsigned long int  size_xyz;
-  unsigned long int  z_size_xy, zm_size_xy, zp_size_xy;
-  unsigned long int  y_size_x, ym_size_x, yp_size_x;
-  analyze_hdr        hdr;
-  unsigned char      *image;
-  Bordercell *borderlist;
-  List SurfaceVoxels;
-
  #include "readwrite_functions.c"
  #include "thinning_functions.c" 
+ #include "component_functions.c"
+
+// O = isthmusthinning(M, Mode, NThreads)
+//
+// The 26-connected components of M are thinned one by one in cropped sub-volumes (bounding box
+// + 1 voxel frame), the output is the same as thinning the whole volume (M does not need a
+// background frame).
+// Mode (optional):
+// 0: sequential isthmus thinning, 6 directional sub-iterations (default)
+// 1: parallel subfield based isthmus thinning (8 subfields, same output whatever NThreads)
+// NThreads (optional): number of threads (default: OpenMP default), the small components are
+// thinned in parallel, in mode 1 the large components are thinned one at a time by all the threads
+
+// Minimum number of voxels of a component thinned by all the threads (mode 1)
+#define LARGE_COMPONENT_VOXELS 262144
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
 	int nDim = mxGetNumberOfDimensions(prhs[0]);
-	const int *pDims = mxGetDimensions(prhs[0]);
-	unsigned char *pD = mxGetPr(prhs[0]);
-	unsigned long int i;
+	const mwSize *pDims = mxGetDimensions(prhs[0]);
+	const unsigned char *image, **rows;
+	unsigned char *out, **out_rows;
+	const unsigned char *lut_simple, *lut_isthmus;
+	unsigned long int ncomps, first, r;
+	Run *runs;
+	Component *comps;
+	int Mode = 0, NThreads = 1, failed = 0;
+	
+	#ifdef _OPENMP
+	NThreads = omp_get_max_threads();
+	#endif
+	if (nrhs > 1) Mode = (int)mxGetScalar(prhs[1]);
+	if (nrhs > 2) NThreads = (int)mxGetScalar(prhs[2]);
+	if (NThreads < 1) NThreads = 1;
 	
 	//mexPrintf("NDim: %i\n",nDim);
 	//mexPrintf("pDim: %i %i %i\n",pDims[0],pDims[1],pDims[2]);
 
-    size_x = pDims[0];
-    size_y = pDims[1];
-    size_z = pDims[2];
-      
-	/* set slice- and image size */   
-    size_xy  = size_x * size_y;
-    size_xyz = size_xy * size_z;
-	
-	// Allocate mex output array: clean way
-	mxArray *incopy = mxDuplicateArray(prhs[0]);
-    image = (unsigned char *)mxGetPr(incopy);
+	// Allocate mex output array: zeroed, only the thinned components are written to it
+	plhs[0] = mxCreateNumericArray(nDim, pDims, mxGetClassID(prhs[0]), mxREAL);
+	out = (unsigned char *)mxGetData(plhs[0]);
+    image = (const unsigned char *)mxGetData(prhs[0]);
+	rows = (const unsigned char **)mxMalloc(pDims[1]*pDims[2]*sizeof(unsigned char *));
+	out_rows = (unsigned char **)mxMalloc(pDims[1]*pDims[2]*sizeof(unsigned char *));
+	for (r = 0; r < pDims[1]*pDims[2]; r++) {
+		rows[r] = image + r*pDims[0];
+		out_rows[r] = out + r*pDims[0];
+	}
 	
 	/****************/
 	/* READING LUTs */
 	/****************/
-    init_lut_simple();
-    init_lut_isthmus();
+    get_luts(&lut_simple, &lut_isthmus);
+	
+	/**************/
+	/* COMPONENTS */
+	/**************/
+	// 26-connected components by decreasing size
+	ncomps = find_components(rows, pDims[0], pDims[1], pDims[2], &runs, &comps);
 	
 	/************/  
 	/* THINNING */
 	/************/
-    sequential_thinning();
+	first = 0;
+	if (Mode == 1)
+		for (; (first < ncomps) && (comps[first].voxels >= LARGE_COMPONENT_VOXELS); first++)
+			if (!thin_component(&comps[first], runs, out_rows, NULL, pDims[0], pDims[1], lut_simple, lut_isthmus, Mode, NThreads)) failed = 1;
+	{
+		long long i;
+		#pragma omp parallel for schedule(dynamic) num_threads(NThreads)
+		for (i = (long long)first; i < (long long)ncomps; i++)
+			if (!failed && !thin_component(&comps[i], runs, out_rows, NULL, pDims[0], pDims[1], lut_simple, lut_isthmus, Mode, 1))
+				failed = 1;
+	}
 	
-	/********/  
+	/********/
 	/* FREE */
 	/********/
-    free(lut_simple);
-    free(lut_isthmus);    
-    
-	// Clean way
-	plhs[0] = incopy;
+	free(runs);
+	free(comps);
+	mxFree(rows);
+	mxFree(out_rows);
+	if (failed) ALLOC_ERROR();
 	
-}
\ No newline at end of file
+}
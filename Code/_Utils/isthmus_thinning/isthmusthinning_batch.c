@@ -0,0 +1,81 @@
+/* include files */
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <math.h>
+  #include <mex.h>
+  #include <omp.h>
+  #include "ibcenterline.h"
+  #include "matrix.h"
+
+ #include "readwrite_functions.c"
+ #include "thinning_functions.c"
+
+// C = isthmusthinning_batch(V, NThreads)
+//
+// Thin the volumes of cell array V (uint8 or logical, 3D, 1 voxel background frame) in parallel:
+// one thinning context per volume, the LUTs are read once and shared by all the threads.
+// C holds the thinned volumes (same output as isthmusthinning applied to each volume).
+// NThreads (optional): number of threads (default: OpenMP default)
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	mwSize nvol, v;
+	int nthreads;
+	const mwSize *pDims;
+	const unsigned char *lut_simple, *lut_isthmus;
+	unsigned char **images;
+	unsigned long int *sizes;
+	mxArray *vol;
+	int failed = 0;
+
+	if ((nrhs < 1) || (nrhs > 2)) mexErrMsgTxt("One or two input arguments required.");
+	if (! mxIsCell(prhs[0])) mexErrMsgTxt("First argument must be a cell array of volumes.");
+	nthreads = (nrhs > 1) ? (int)mxGetScalar(prhs[1]) : omp_get_max_threads();
+	if (nthreads < 1) nthreads = 1;
+
+	// Copy the volumes (all MATLAB API calls are made before the parallel section)
+	nvol = mxGetNumberOfElements(prhs[0]);
+	plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(prhs[0]), mxGetDimensions(prhs[0]));
+	images = (unsigned char **)mxMalloc(nvol*sizeof(unsigned char *));
+	sizes = (unsigned long int *)mxMalloc(3*nvol*sizeof(unsigned long int));
+	for (v = 0; v < nvol; v++) {
+		vol = mxGetCell(prhs[0], v);
+		if ((vol == NULL) || ((! mxIsUint8(vol)) && (! mxIsLogical(vol))) || (mxGetNumberOfDimensions(vol) != 3))
+			mexErrMsgTxt("Volumes must be 3D uint8 or logical arrays.");
+		pDims = mxGetDimensions(vol);
+		vol = mxDuplicateArray(vol);
+		mxSetCell(plhs[0], v, vol);
+		images[v] = (unsigned char *)mxGetData(vol);
+		sizes[3*v] = pDims[0];
+		sizes[3*v+1] = pDims[1];
+		sizes[3*v+2] = pDims[2];
+	}
+
+	/****************/
+	/* READING LUTs */
+	/****************/
+    get_luts(&lut_simple, &lut_isthmus);
+
+	/************/
+	/* THINNING */
+	/************/
+	{
+		long long i;
+		#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+		for (i = 0; i < (long long)nvol; i++) {
+			ThinningContext ctx;
+			init_thinning_context(&ctx, images[i], sizes[3*i], sizes[3*i+1], sizes[3*i+2], lut_simple, lut_isthmus);
+			sequential_thinning(&ctx);
+			if (ctx.failed) failed = 1;
+		}
+	}
+
+	/********/
+	/* FREE */
+	/********/
+	mxFree(images);
+	mxFree(sizes);
+	if (failed) ALLOC_ERROR();
+
+}
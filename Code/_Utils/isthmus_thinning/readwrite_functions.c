@@ -4,38 +4,134 @@
 *       Author:              K. Palagyi
 *       Date:                14 November, 2013 
 * 
+*       The standalone program maps its input in memory (Analyze, raw or
+*       uncompressed 8 bit TIFF) and streams its output, the image is never
+*       copied: the thinning works on cropped components (see
+*       component_functions.c), so volumes larger than the memory can be
+*       processed.
+*
 *******************************************************************************/
 
-/*========= function read_image =========*/
+#ifndef MATLAB_MEX_FILE
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+/*========= function map_file =========*/
 /* -------------
-  considered global variables:
-      NONE
-  changed global variables:
-      hdr
-      size_x
-      size_y
-      size_z
-      size_xy
-      size_xyz
-      image
+  maps file file_name (read only), returns its data and its length
 ----------------*/  
-void read_image( char *inp_name )
+static const unsigned char *map_file( const char *file_name, size_t *length )
 {
-  char file_name[300];
-  FILE              *fp_inp_img;
-  FILE              *fp_inp_hdr;
-  short int          hdrshortint;
-  unsigned long int  i, j, p, num;
-  short int          perm;
-  
-  /* open IMG */
-    strcpy(file_name, inp_name);
-    strcat(file_name, ".img");
-    if ( (fp_inp_img = fopen(file_name, "rb")) == NULL)
+  const unsigned char *data = NULL;
+#ifdef _WIN32
+  HANDLE         file, mapping;
+  LARGE_INTEGER  size;
+
+    file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if ( file == INVALID_HANDLE_VALUE )
       {
         printf("ERROR: Can't open the input image data: %s!\n", file_name);
         exit(1);
       }
+    if ( ( ! GetFileSizeEx(file, &size) ) || ( size.QuadPart == 0 ) )
+      {
+        printf("ERROR: Empty input image data: %s!\n", file_name);
+        exit(1);
+      }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if ( mapping != NULL )
+      {
+        data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+      }
+    CloseHandle(file);
+    *length = (size_t)size.QuadPart;
+#else
+  int          fd;
+  struct stat  st;
+  void         *p;
+
+    fd = open(file_name, O_RDONLY);
+    if ( fd < 0 )
+      {
+        printf("ERROR: Can't open the input image data: %s!\n", file_name);
+        exit(1);
+      }
+    if ( ( fstat(fd, &st) != 0 ) || ( st.st_size == 0 ) )
+      {
+        printf("ERROR: Empty input image data: %s!\n", file_name);
+        exit(1);
+      }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( p != MAP_FAILED ) data = (const unsigned char *)p;
+    *length = (size_t)st.st_size;
+#endif
+    if ( data == NULL )
+      {
+        printf("ERROR: Can't map the input image data: %s!\n", file_name);
+        exit(1);
+      }
+    return data;
+}
+/*========= end of function map_file =========*/
+
+
+/*========= function unmap_volume =========*/
+void unmap_volume( MappedVolume *vol )
+{
+#ifdef _WIN32
+    UnmapViewOfFile((LPCVOID)vol->data);
+#else
+    munmap((void *)vol->data, vol->length);
+#endif
+    free((void *)vol->rows);
+    vol->rows = NULL;
+    vol->data = NULL;
+}
+/*========= end of function unmap_volume =========*/
+
+
+/* rows of a contiguous volume of size_x*size_y*size_z voxels at offset */
+static void contiguous_rows( MappedVolume *vol, size_t offset, const char *file_name )
+{
+  unsigned long int r, nrows = vol->size_y*vol->size_z;
+
+    if ( offset + (size_t)vol->size_x*nrows > vol->length )
+      {
+        printf("ERROR: Couldn't read image data (%s is truncated)\n", file_name);
+        exit(2);
+      }
+    vol->rows = (const unsigned char **)malloc(( nrows > 0 ? nrows : 1 )*sizeof(unsigned char *));
+    if ( vol->rows == NULL )
+      {
+        printf("\n Alloc. error (rows)");
+        exit(0);
+      }
+    for ( r=0; r<nrows; r++ )
+      vol->rows[r] = vol->data + offset + (size_t)r*vol->size_x;
+}
+
+
+/*========= function map_analyze =========*/
+/* -------------
+  maps the Analyze image inp_name (.hdr + .img, 8 bit) and returns the
+  header in hdr
+----------------*/  
+void map_analyze( const char *inp_name, analyze_hdr *hdr, MappedVolume *vol )
+{
+  char file_name[300];
+  FILE              *fp_inp_hdr;
+  short int          hdrshortint;
+  short int          perm;
       
    /* open HDR */
     strcpy(file_name, inp_name);
@@ -47,7 +143,7 @@ void read_image( char *inp_name )
       }
     
   /* read HDR */    
-    if ( fread(&hdr, sizeof(analyze_hdr), 1, fp_inp_hdr) != 1 )
+    if ( fread(hdr, sizeof(analyze_hdr), 1, fp_inp_hdr) != 1 )
       {
         printf("ERROR: Couldn't read input header\n");
         exit(1);
@@ -56,11 +152,11 @@ void read_image( char *inp_name )
     
   /* set perm */  
     perm = 0;
-    if ( hdr.sizeof_hdr != sizeof(analyze_hdr) )
+    if ( hdr->sizeof_hdr != sizeof(analyze_hdr) )
       perm = 1;
       
   /* binary ? */    
-    hdrshortint = hdr.bits;
+    hdrshortint = hdr->bits;
     if ( perm ) 
       hdrshortint = ( hdrshortint<<8 ) | ( (hdrshortint>>8) & 0x00FF );
     if ( hdrshortint !=8 )
@@ -70,97 +166,219 @@ void read_image( char *inp_name )
       }
       
   /* set dimensions */
-    hdrshortint = hdr.x_dim;
+    hdrshortint = hdr->x_dim;
     if ( perm ) 
       hdrshortint = ( hdrshortint<<8 ) | ( (hdrshortint>>8) & 0x00FF );
-    size_x = (unsigned long int)hdrshortint;
-    hdrshortint = hdr.y_dim;
+    vol->size_x = (unsigned long int)hdrshortint;
+    hdrshortint = hdr->y_dim;
     if ( perm ) 
       hdrshortint = ( hdrshortint<<8 ) | ( (hdrshortint>>8) & 0x00FF );
-    size_y = (unsigned long int)hdrshortint;
-    hdrshortint = hdr.z_dim;
+    vol->size_y = (unsigned long int)hdrshortint;
+    hdrshortint = hdr->z_dim;
     if ( perm ) 
       hdrshortint = ( hdrshortint<<8 ) | ( (hdrshortint>>8) & 0x00FF );
-    size_z = (unsigned long int)hdrshortint;
-    if ( size_z <= 1 )
+    vol->size_z = (unsigned long int)hdrshortint;
+
+  /* map IMG */
+    strcpy(file_name, inp_name);
+    strcat(file_name, ".img");
+    vol->data = map_file(file_name, &vol->length);
+    contiguous_rows(vol, 0, file_name);
+}  
+/*========= end of function map_analyze =========*/
+
+
+/*========= function map_raw =========*/
+/* -------------
+  maps the raw 8 bit image file_name of size size_x, size_y, size_z
+----------------*/  
+void map_raw( const char *file_name, unsigned long int size_x, unsigned long int size_y,
+              unsigned long int size_z, MappedVolume *vol )
+{
+    vol->size_x = size_x;
+    vol->size_y = size_y;
+    vol->size_z = size_z;
+    vol->data = map_file(file_name, &vol->length);
+    contiguous_rows(vol, 0, file_name);
+}
+/*========= end of function map_raw =========*/
+
+
+/* TIFF field value: inline if it fits in 4 bytes, at offset otherwise */
+static unsigned long int tiff_value( const MappedVolume *vol, int be, size_t pos )
+{
+  const unsigned char *p = vol->data + pos;
+    if ( be ) return ((unsigned long int)p[0]<<24) | ((unsigned long int)p[1]<<16) |
+                     ((unsigned long int)p[2]<<8) | p[3];
+    return ((unsigned long int)p[3]<<24) | ((unsigned long int)p[2]<<16) |
+           ((unsigned long int)p[1]<<8) | p[0];
+}
+
+static unsigned long int tiff_short( const MappedVolume *vol, int be, size_t pos )
+{
+  const unsigned char *p = vol->data + pos;
+    return be ? ( ((unsigned long int)p[0]<<8) | p[1] ) : ( ((unsigned long int)p[1]<<8) | p[0] );
+}
+
+/* element i of the SHORT or LONG field of entry pos */
+static unsigned long int tiff_field( const MappedVolume *vol, int be, size_t pos,
+                                     unsigned long int i )
+{
+  unsigned long int type  = tiff_short(vol, be, pos+2);
+  unsigned long int count = tiff_value(vol, be, pos+4);
+  unsigned long int size  = ( type == 3 ) ? 2 : 4;
+  size_t at = ( count*size <= 4 ) ? pos+8 : (size_t)tiff_value(vol, be, pos+8);
+
+    at += (size_t)i*size;
+    if ( at + size > vol->length )
       {
-        printf("ERROR: The image data is not a real 3D one. Number of slices is %d \n", size_z);
-        exit(-1);
-      }  
-     printf("\n Size of the input image: %d, %d, %d\n", size_x, size_y, size_z);
-     
-  /* add frame */
-    size_x += 2;
-    size_y += 2;
-    size_z += 2;
-      
-  /* set slice- and image size */   
-    size_xy  = size_x * size_y;
-    size_xyz = size_xy * size_z;
-    
-  /* alloc image */
-    image = (unsigned char *)malloc(size_xyz);
-    if ( image == NULL )
+        printf("ERROR: Corrupted TIFF file\n");
+        exit(2);
+      }
+    return ( type == 3 ) ? tiff_short(vol, be, at) : tiff_value(vol, be, at);
+}
+
+
+/*========= function map_tiff =========*/
+/* -------------
+  maps the multi-page TIFF file_name (8 bit, 1 sample per pixel,
+  uncompressed strips), a page per slice
+----------------*/  
+void map_tiff( const char *file_name, MappedVolume *vol )
+{
+  int                be;
+  size_t             ifd, pos, strips, rps_entry;
+  unsigned long int  n, e, tag, width, height, bits, compression, samples, rps, r, s, capacity = 0;
+
+    vol->data = map_file(file_name, &vol->length);
+    vol->rows = NULL;
+    if ( ( vol->length < 8 ) || ! ( ( vol->data[0] == 'I' && vol->data[1] == 'I' ) ||
+                                    ( vol->data[0] == 'M' && vol->data[1] == 'M' ) ) )
       {
-         printf("\n Alloc. error (image)");
-         exit(0);
+        printf("ERROR: %s is not a TIFF file\n", file_name);
+        exit(2);
+      }
+    be = ( vol->data[0] == 'M' );
+    if ( tiff_short(vol, be, 2) != 42 )
+      {
+        printf("ERROR: Cannot handle BigTIFF file %s\n", file_name);
+        exit(2);
       }
-      
-  /* init image */
-    for (i=0; i<size_xyz; i++)
-      *(image +i) = 0;
 
-  /* read image */ 
-    p = size_xy + size_x + 1;
-    for (i=1; i<size_z-1; i++)
+    vol->size_x = vol->size_y = vol->size_z = 0;
+    for ( ifd = tiff_value(vol, be, 4); ifd != 0; ifd = tiff_value(vol, be, pos) )
       {
-        for (j=1; j<size_y-1; j++)
+        if ( ifd + 2 > vol->length ) break;
+        n = tiff_short(vol, be, ifd);
+        pos = ifd + 2;
+        if ( pos + 12*n + 4 > vol->length ) break;
+        width = height = rps = 0; bits = compression = samples = 1; strips = rps_entry = 0;
+        for ( e=0; e<n; e++, pos+=12 )
+          {
+            tag = tiff_short(vol, be, pos);
+            if ( tag == 256 ) width       = tiff_field(vol, be, pos, 0);
+            if ( tag == 257 ) height      = tiff_field(vol, be, pos, 0);
+            if ( tag == 258 ) bits        = tiff_field(vol, be, pos, 0);
+            if ( tag == 259 ) compression = tiff_field(vol, be, pos, 0);
+            if ( tag == 273 ) strips      = pos;
+            if ( tag == 277 ) samples     = tiff_field(vol, be, pos, 0);
+            if ( tag == 278 ) rps_entry   = pos;
+          }
+        if ( ( bits != 8 ) || ( compression != 1 ) || ( samples != 1 ) || ( strips == 0 ) )
+          {
+            printf("ERROR: Can only handle uncompressed 8 bit grayscale TIFF strips\n");
+            exit(-1);
+          }
+        if ( vol->size_z == 0 )
+          {
+            vol->size_x = width;
+            vol->size_y = height;
+          }
+        else if ( ( width != vol->size_x ) || ( height != vol->size_y ) )
+          {
+            printf("ERROR: The TIFF pages have different sizes\n");
+            exit(-1);
+          }
+        rps = rps_entry ? tiff_field(vol, be, rps_entry, 0) : height;
+        if ( rps == 0 ) rps = height;
+
+        /* rows of the page */
+        if ( ( vol->size_z+1 )*height > capacity )
+          {
+            capacity = 2*( vol->size_z+1 )*height;
+            vol->rows = (const unsigned char **)realloc((void *)vol->rows, capacity*sizeof(unsigned char *));
+            if ( vol->rows == NULL )
+              {
+                printf("\n Alloc. error (rows)");
+                exit(0);
+              }
+          }
+        for ( r=0; r<height; r++ )
           {
-            if ( fread(image+p, 1, size_x-2, fp_inp_img) != (size_x-2) )
+            s = tiff_field(vol, be, strips, r / rps) + ( r % rps )*width;
+            if ( (size_t)s + width > vol->length )
               {
-                printf("ERROR: Couldn't read image data\n");
+                printf("ERROR: Couldn't read image data (%s is truncated)\n", file_name);
                 exit(2);
               }
-            p+=size_x;
+            vol->rows[vol->size_z*height + r] = vol->data + s;
           }
-        p+=(2*size_x);
+        vol->size_z++;
       }
-    fclose(fp_inp_img);
-
-  /* counting object points and set 1 */
-    num = 0;
-    for (i=0; i<size_xyz; i++)
-      if ( *(image +i) )
-        {
-	  *(image +i) = 1;
-          num++;
-	}
-    printf("\n Number of object points in the original image: %d\n", num);
-    
-}  
-/*========= end of function read_image =========*/
+    if ( vol->size_z == 0 )
+      {
+        printf("ERROR: No image in %s\n", file_name);
+        exit(2);
+      }
+}
+/*========= end of function map_tiff =========*/
 
 
+/*========= function make_analyze_hdr =========*/
+/* -------------
+  Analyze header of an 8 bit image of size size_x, size_y, size_z
+----------------*/  
+void make_analyze_hdr( analyze_hdr *hdr, unsigned long int size_x,
+                       unsigned long int size_y, unsigned long int size_z )
+{
+    memset(hdr, 0, sizeof(analyze_hdr));
+    hdr->sizeof_hdr = sizeof(analyze_hdr);
+    hdr->extents    = 16384;
+    hdr->regular    = 'r';
+    hdr->dims       = 4;
+    hdr->x_dim      = (short int)size_x;
+    hdr->y_dim      = (short int)size_y;
+    hdr->z_dim      = (short int)size_z;
+    hdr->t_dim      = 1;
+    hdr->datatype   = 2;
+    hdr->bits       = 8;
+    hdr->x_size     = hdr->y_size = hdr->z_size = 1.0f;
+    hdr->glmax      = 255;
+}
+/*========= end of function make_analyze_hdr =========*/
+
 
-/*========= function write_image =========*/
+static int compare_indices( const void *a, const void *b )
+{
+  unsigned long int ia = *(const unsigned long int *)a, ib = *(const unsigned long int *)b;
+  return ( ia > ib ) - ( ia < ib );
+}
+
+/*========= function write_skeleton =========*/
 /* -------------
-  considered global variables:
-      hdr
-      size_x
-      size_y
-      size_z
-      size_xy
-      size_xyz
-  changed global variables:
-      image 
+  writes the skeleton (linear indices of its voxels in an image of size
+  size_x, size_y, size_z) to the Analyze image out_name (voxels set to 255),
+  the image data is streamed row by row
 ----------------*/  
-void write_image( char *out_name )
+void write_skeleton( const char *out_name, const analyze_hdr *hdr, SurfaceList *skeleton,
+                     unsigned long int size_x, unsigned long int size_y,
+                     unsigned long int size_z )
 {
   char file_name[300];
   FILE              *fp_out_img;
   FILE              *fp_out_hdr;
-  unsigned long int  i, j, p, num;
- 
+  unsigned char     *row;
+  unsigned long int  r, i, nrows = size_y*size_z;
     
   /* open IMG */
     strcpy(file_name, out_name);
@@ -181,179 +399,205 @@ void write_image( char *out_name )
       }
     
   /* write HDR */    
-    if ( fwrite(&hdr, sizeof(analyze_hdr), 1, fp_out_hdr) != 1 )
+    if ( fwrite(hdr, sizeof(analyze_hdr), 1, fp_out_hdr) != 1 )
       {
-        printf("ERROR: Couldn't read input header\n");
+        printf("ERROR: Couldn't write output header\n");
         exit(1);
       }
     fclose(fp_out_hdr);
     
-  /* set non-zero to 255 */
-    num=0;
-    for (i=0; i<size_xyz; i++)
-      if ( *(image +i) )
-        {
-          *(image +i) = 0xFF;
-          num++;
-        }
-    printf("\n\n Number of object points in the skeleton: %d\n", num);
+    printf("\n\n Number of object points in the skeleton: %lu\n", skeleton->length);
     
   /* write image */
-    p = size_xy + size_x + 1;
-    for (i=1; i<size_z-1; i++)
+    qsort(skeleton->voxel, skeleton->length, sizeof(unsigned long int), compare_indices);
+    row = (unsigned char *)calloc(size_x > 0 ? size_x : 1, 1);
+    if ( row == NULL )
       {
-        for (j=1; j<size_y-1; j++)
+         printf("\n Alloc. error (row)");
+         exit(0);
+      }
+    for ( r=0, i=0; r<nrows; r++ )
+      {
+        for ( ; ( i < skeleton->length ) && ( skeleton->voxel[i] / size_x == r ); i++ )
+          row[skeleton->voxel[i] % size_x] = 0xFF;
+        if ( fwrite(row, 1, size_x, fp_out_img) != size_x )
           {
-            if ( fwrite(image+p, 1, size_x-2, fp_out_img) != (size_x-2) )
-              {
-                printf("ERROR: Couldn't write image data\n");
-                exit(2);
-              }
-            p+=size_x;
+            printf("ERROR: Couldn't write image data\n");
+            exit(2);
           }
-        p+=(2*size_x);
+        memset(row, 0, size_x);
       }
+    free(row);
     fclose(fp_out_img);
-    
 }  
-/*========= end of function write_image =========*/
+/*========= end of function write_skeleton =========*/
 
 
-/*========= function set_long_mask =========*/
+/*========= function write_skeleton_list =========*/
 /* -------------
-  considered global variables:
-      NONE
-  changed global variables:
-      long_mask 
+  writes the coordinates (x y z, from 0) of the skeleton voxels to the text
+  file out_name.txt, after the image size
 ----------------*/  
-void set_long_mask( void )
-  {
-    long_mask[ 0] = 0x00000001;
-    long_mask[ 1] = 0x00000002;
-    long_mask[ 2] = 0x00000004;
-    long_mask[ 3] = 0x00000008;
-    long_mask[ 4] = 0x00000010;
-    long_mask[ 5] = 0x00000020;
-    long_mask[ 6] = 0x00000040;
-    long_mask[ 7] = 0x00000080;
-    long_mask[ 8] = 0x00000100;
-    long_mask[ 9] = 0x00000200;
-    long_mask[10] = 0x00000400;
-    long_mask[11] = 0x00000800;
-    long_mask[12] = 0x00001000;
-    long_mask[13] = 0x00002000;
-    long_mask[14] = 0x00004000;
-    long_mask[15] = 0x00008000;
-    long_mask[16] = 0x00010000;
-    long_mask[17] = 0x00020000;
-    long_mask[18] = 0x00040000;
-    long_mask[19] = 0x00080000;
-    long_mask[20] = 0x00100000;
-    long_mask[21] = 0x00200000;
-    long_mask[22] = 0x00400000;
-    long_mask[23] = 0x00800000;
-    long_mask[24] = 0x01000000;
-    long_mask[25] = 0x02000000;
-  }
-/*========= end of function set_char_mask =========*/
-
-
-/*========= function set_char_mask =========*/
-/* -------------
-  considered global variables:
-      NONE
-  changed global variables:
-      char_mask 
-----------------*/  
-void set_char_mask( void )
-  {
-    char_mask[0] = 0x01;
-    char_mask[1] = 0x02;
-    char_mask[2] = 0x04;
-    char_mask[3] = 0x08;
-    char_mask[4] = 0x10;
-    char_mask[5] = 0x20;
-    char_mask[6] = 0x40;
-    char_mask[7] = 0x80;
-  }
-/*========= end of function set_long_mask =========*/
+void write_skeleton_list( const char *out_name, SurfaceList *skeleton,
+                          unsigned long int size_x, unsigned long int size_y,
+                          unsigned long int size_z )
+{
+  char file_name[300];
+  FILE              *fp_out;
+  unsigned long int  i, k;
+
+    strcpy(file_name, out_name);
+    strcat(file_name, ".txt");
+    if ( (fp_out = fopen(file_name, "w")) == NULL)
+      {
+        printf("ERROR: Can't open the output voxel list: %s!\n", file_name);
+        exit(1);
+      }
+    printf("\n\n Number of object points in the skeleton: %lu\n", skeleton->length);
+    qsort(skeleton->voxel, skeleton->length, sizeof(unsigned long int), compare_indices);
+    fprintf(fp_out, "%lu %lu %lu\n", size_x, size_y, size_z);
+    for ( i=0; i<skeleton->length; i++ )
+      {
+        k = skeleton->voxel[i];
+        fprintf(fp_out, "%lu %lu %lu\n", k % size_x, ( k / size_x ) % size_y, k / ( size_x*size_y ));
+      }
+    fclose(fp_out);
+}
+/*========= end of function write_skeleton_list =========*/
 
+#endif
 
-/*============= function init_lut_simple =============*/
+
+
+/* errors while reading the LUTs or allocating memory: MATLAB error in the MEX
+   files (the process must not exit), message + exit in the standalone program.
+   Main thread only: the thinning functions report an allocation failure in
+   their context (failed) and the caller raises the error after the threads */
+#ifdef MATLAB_MEX_FILE
+  #define LUT_ERROR(msg)     mexErrMsgTxt(msg)
+#else
+  #define LUT_ERROR(msg)     { printf("\n\n %s\n", msg); exit(1); }
+#endif
+#define ALLOC_ERROR()        LUT_ERROR("Alloc error!!!")
+
+#define LUT_SIZE           0x00800000
+
+/* folder of the LUT files ("": current folder) */
+static char lut_folder[1024] = "";
+
+/*============= function read_lut =============*/
 /* -------------
-  considered global variables:
-      NONE
-  changed global variables:
-      lut_simple
-      long_mask
-      char_mask 
+  returns the LUT read from file lutname (in lut_folder)
 ----------------*/  
-void init_lut_simple( void )
+unsigned char *read_lut( const char *lutname )
 {
-  char  lutname [100];
+  char  file_name [1200];
+  char  msg [1300];
   FILE  *lutfile;
+  unsigned char *lut;
+  size_t nread;
 
-  /* alloc lut_simple */
-    lut_simple = (unsigned char *)malloc(0x00800000);
-    if ( lut_simple == NULL)
-      {
-        printf("\n Alloc error!!!\n");
-        exit(1);
-      }  /* end if */ 
+  /* alloc lut */
+    lut = (unsigned char *)malloc(LUT_SIZE);
+    if ( lut == NULL)
+      LUT_ERROR("Alloc error (LUT)!!!");
 
   /* open lutfile */
-    strcpy( lutname, "lut_simple.dat");
-    lutfile = fopen( lutname, "rb");
+    strcpy( file_name, lut_folder );
+    strcat( file_name, lutname );
+    lutfile = fopen( file_name, "rb");
     if ( lutfile == NULL)
       {
-        printf("\n\n file lut.dat is not found!!!\n");
-        exit(1);
+        free(lut);
+        sprintf( msg, "LUT file %s is not found!!!", file_name );
+        LUT_ERROR(msg);
       }  /* end if */
 
   /* reading lutfile */
-    fread( lut_simple, 1, 0x00800000, lutfile);
+    nread = fread( lut, 1, LUT_SIZE, lutfile);
     fclose(lutfile);
+    if ( nread != LUT_SIZE )
+      {
+        free(lut);
+        sprintf( msg, "LUT file %s is truncated!!!", file_name );
+        LUT_ERROR(msg);
+      }  /* end if */
+
+    return lut;
+}
+/*=========== end of function read_lut ===========*/
 
-  /* setting masks */
-    set_long_mask();
-    set_char_mask();
 
+/*============= function init_lut_simple =============*/
+/* -------------
+  returns the simple point LUT read from lut_simple.dat
+----------------*/  
+unsigned char *init_lut_simple( void )
+{
+    return read_lut("lut_simple.dat");
 }
 /*=========== end of function init_lut_simple ===========*/
 
 
 /*============= function init_lut_isthmus =============*/
 /* -------------
-  considered global variables:
-      NONE
-  changed global variables:
-      lut_isthmus
+  returns the isthmus LUT read from lut_isthmus.dat
 ----------------*/  
-void init_lut_isthmus( void )
+unsigned char *init_lut_isthmus( void )
 {
-  char  lutname [100];
-  FILE  *lutfile;
+    return read_lut("lut_isthmus.dat");
+}
+/*=========== end of function init_lut_isthmus ===========*/
 
-  /* alloc lut_isthmus */
-    lut_isthmus = (unsigned char *)malloc(0x00800000);
-    if ( lut_isthmus == NULL)
-      {
-        printf("\n Alloc error!!!\n");
-        exit(1);
-      }  /* end if */ 
 
-  /* open lutfile */
-    strcpy( lutname, "lut_isthmus.dat");
-    lutfile = fopen( lutname, "rb");
-    if ( lutfile == NULL)
-      {
-        printf("\n\n file lut_isthmus.dat is not found!!!\n");
-        exit(1);
-      }  /* end if */
+#ifdef MATLAB_MEX_FILE
+/* MEX files: the LUTs are read once, from the folder of the MEX file, on the
+   first call and kept until the MEX file is cleared (they are read-only and
+   shared by all the thinning contexts) */
+static unsigned char *lut_simple_cache  = NULL;
+static unsigned char *lut_isthmus_cache = NULL;
 
-  /* reading lutfile */
-    fread( lut_isthmus, 1, 0x00800000, lutfile);
-    fclose(lutfile);
+static void free_luts( void )
+{
+    free(lut_simple_cache);
+    free(lut_isthmus_cache);
+    lut_simple_cache  = NULL;
+    lut_isthmus_cache = NULL;
+}
 
+/*============= function get_luts =============*/
+void get_luts( const unsigned char **lut_simple, const unsigned char **lut_isthmus )
+{
+  mxArray *name, *path;
+  char *file;
+  char *sep, *bsep;
+
+    if ( ( lut_simple_cache == NULL ) || ( lut_isthmus_cache == NULL ) )
+      {
+        /* folder of the MEX file */
+        name = mxCreateString(mexFunctionName());
+        if ( ( mexCallMATLAB(1, &path, 1, &name, "which") == 0 ) &&
+             ( (file = mxArrayToString(path)) != NULL ) )
+          {
+            sep  = strrchr(file, '/');
+            bsep = strrchr(file, '\\');
+            if ( ( sep == NULL ) || ( ( bsep != NULL ) && ( bsep > sep ) ) ) sep = bsep;
+            if ( ( sep != NULL ) && ( (size_t)(sep-file+1) < sizeof(lut_folder) ) )
+              {
+                strncpy(lut_folder, file, sep-file+1);
+                lut_folder[sep-file+1] = '\0';
+              }
+            mxFree(file);
+            mxDestroyArray(path);
+          }
+        mxDestroyArray(name);
+
+        mexAtExit(free_luts);
+        if ( lut_simple_cache == NULL ) lut_simple_cache = init_lut_simple();
+        if ( lut_isthmus_cache == NULL ) lut_isthmus_cache = init_lut_isthmus();
+      }
+    *lut_simple  = lut_simple_cache;
+    *lut_isthmus = lut_isthmus_cache;
 }
-/*=========== end of function init_lut_isthmus ===========*/
+/*=========== end of function get_luts ===========*/
+#endif
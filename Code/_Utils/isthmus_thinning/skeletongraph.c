@@ -0,0 +1,173 @@
+/* include files */
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <math.h>
+  #include <mex.h>
+  #include "ibcenterline.h"
+  #include "matrix.h"
+
+ #include "thinning_functions.c"
+ #include "graph_functions.c"
+
+// [A, node, link] = skeletongraph(S, THR)
+//
+// Native replacement of Skel2Graph3D (same outputs, same node and link ordering): the voxels of
+// skeleton S (2D or 3D, logical, uint8 or double) are classified from their 26-neighbourhood
+// code (1 neighbour: end, 2: link, more: branch voxel) and the links are traced in one pass.
+// THR (optional): minimum length of the links to an end node (default: 0)
+// A: sparse adjacency matrix, link lengths (voxels) as weights
+// node: idx, links, conn, comx, comy, comz, ep, label
+// link: n1, n2, point, label (point: linear indices of the link voxels, end nodes included)
+// The skeleton labels are returned as double.
+
+typedef struct {
+	unsigned long int row, col, seq;
+	double val;
+} AdjacencyEntry;
+
+static int compare_entries(const void *a, const void *b)
+{
+	const AdjacencyEntry *ea = (const AdjacencyEntry *)a, *eb = (const AdjacencyEntry *)b;
+	if (ea->col != eb->col) return (ea->col > eb->col) - (ea->col < eb->col);
+	if (ea->row != eb->row) return (ea->row > eb->row) - (ea->row < eb->row);
+	return (ea->seq > eb->seq) - (ea->seq < eb->seq);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	const char *node_fields[8] = {"idx", "links", "conn", "comx", "comy", "comz", "ep", "label"};
+	const char *link_fields[4] = {"n1", "n2", "point", "label"};
+	const mwSize *pDims;
+	mwSize nDim, m, n, d, x, y, z, k;
+	double thr = 0, *pr, cx, cy, cz;
+	const unsigned char *pu = NULL;
+	const double *pd = NULL;
+	SkeletonGraph g;
+	unsigned long int i, j, l, v, f, nl, ne, o;
+	AdjacencyEntry *entries;
+	mxArray *a;
+	mwIndex *ir, *jc;
+	short *pc;
+
+	if ((nrhs < 1) || (nrhs > 2)) mexErrMsgTxt("One or two input arguments required.");
+	if (mxIsLogical(prhs[0]) || mxIsUint8(prhs[0])) pu = (const unsigned char *)mxGetData(prhs[0]);
+	else if (mxIsDouble(prhs[0])) pd = mxGetPr(prhs[0]);
+	else mexErrMsgTxt("S must be a logical, uint8 or double array.");
+	if (nrhs > 1) thr = mxGetScalar(prhs[1]);
+	nDim = mxGetNumberOfDimensions(prhs[0]);
+	if (nDim > 3) mexErrMsgTxt("S must be a 2D or 3D array.");
+	pDims = mxGetDimensions(prhs[0]);
+	m = pDims[0]; n = pDims[1]; d = (nDim > 2) ? pDims[2] : 1;
+
+	/*********/
+	/* GRAPH */
+	/*********/
+	init_skeleton_graph(&g, m, n, d);
+	for (z = 0, k = 0; z < d; z++)
+		for (y = 0; y < n; y++)
+			for (x = 0; x < m; x++, k++)
+				if (pu ? (pu[k] != 0) : (pd[k] != 0)) add_skeleton_voxel(&g, x, y, z);
+	build_skeleton_graph(&g, thr);
+
+	/*********/
+	/* NODES */
+	/*********/
+	plhs[1] = mxCreateStructMatrix(1, g.nnodes, 8, node_fields);
+	for (i = 0; i < g.nnodes; i++) {
+		f = g.node_first[i];
+		nl = g.node_link_first[i+1] - g.node_link_first[i];
+		a = mxCreateDoubleMatrix(g.node_first[i+1] - f, 1, mxREAL);
+		pr = mxGetPr(a);
+		cx = cy = cz = 0;
+		for (j = f; j < g.node_first[i+1]; j++) {
+			v = g.voxel[g.node_vox[j]];
+			x = v % g.ctx.size_x; y = (v / g.ctx.size_x) % g.ctx.size_y; z = v / g.ctx.size_xy;
+			pr[j-f] = (double)(x + (y-1)*m + (z-1)*m*n);
+			cy += x; cx += y; cz += z;
+		}
+		mxSetField(plhs[1], i, "idx", a);
+		if (nl > 0) {
+			a = mxCreateDoubleMatrix(1, nl, mxREAL);
+			pr = mxGetPr(a);
+			for (j = 0; j < nl; j++) pr[j] = (double)(g.node_links[g.node_link_first[i]+j] + 1);
+			mxSetField(plhs[1], i, "links", a);
+			a = mxCreateNumericMatrix(1, nl, mxINT16_CLASS, mxREAL);
+			pc = (short *)mxGetData(a);
+			for (j = 0; j < nl; j++) {
+				l = g.node_links[g.node_link_first[i]+j];
+				o = (g.link_n1[l] == i) ? g.link_n2[l] : g.link_n1[l];
+				pc[j] = (short)((o + 1 > 32767) ? 32767 : o + 1);
+			}
+			mxSetField(plhs[1], i, "conn", a);
+		}
+		else {
+			mxSetField(plhs[1], i, "links", mxCreateDoubleMatrix(0, 0, mxREAL));
+			mxSetField(plhs[1], i, "conn", mxCreateDoubleMatrix(0, 0, mxREAL));
+		}
+		j = g.node_first[i+1] - f;
+		mxSetField(plhs[1], i, "comx", mxCreateDoubleScalar(cx / j));
+		mxSetField(plhs[1], i, "comy", mxCreateDoubleScalar(cy / j));
+		mxSetField(plhs[1], i, "comz", mxCreateDoubleScalar(cz / j));
+		mxSetField(plhs[1], i, "ep", mxCreateDoubleScalar(g.node_ep[i]));
+		mxSetField(plhs[1], i, "label", mxCreateDoubleScalar((double)g.label[g.node_vox[f]]));
+	}
+
+	/*********/
+	/* LINKS */
+	/*********/
+	plhs[2] = mxCreateStructMatrix(1, g.nlinks, 4, link_fields);
+	for (l = 0; l < g.nlinks; l++) {
+		mxSetField(plhs[2], l, "n1", mxCreateDoubleScalar((double)(g.link_n1[l] + 1)));
+		mxSetField(plhs[2], l, "n2", mxCreateDoubleScalar((double)(g.link_n2[l] + 1)));
+		a = mxCreateDoubleMatrix(1, g.link_first[l+1] - g.link_first[l], mxREAL);
+		pr = mxGetPr(a);
+		for (j = g.link_first[l]; j < g.link_first[l+1]; j++) {
+			v = g.voxel[g.points[j]];
+			x = v % g.ctx.size_x; y = (v / g.ctx.size_x) % g.ctx.size_y; z = v / g.ctx.size_xy;
+			pr[j-g.link_first[l]] = (double)(x + (y-1)*m + (z-1)*m*n);
+		}
+		mxSetField(plhs[2], l, "point", a);
+		mxSetField(plhs[2], l, "label", mxCreateDoubleScalar((double)g.label[g.points[g.link_first[l]]]));
+	}
+
+	/*************/
+	/* ADJACENCY */
+	/*************/
+	// Entries written in the order of Skel2Graph3D, the last write of an entry is kept
+	entries = (AdjacencyEntry *)mxMalloc((4*g.nlinks+1)*sizeof(AdjacencyEntry));
+	ne = 0;
+	for (i = 0; i < g.nnodes; i++)
+		for (j = g.node_link_first[i]; j < g.node_link_first[i+1]; j++) {
+			l = g.node_links[j];
+			for (o = 0; o < 2; o++) {
+				if ((o == 0) ? (g.link_n1[l] != i) : (g.link_n2[l] != i)) continue;
+				v = (o == 0) ? g.link_n2[l] : g.link_n1[l];
+				entries[ne].row = i; entries[ne].col = v; entries[ne].seq = ne;
+				entries[ne].val = (double)(g.link_first[l+1] - g.link_first[l]); ne++;
+				entries[ne].row = v; entries[ne].col = i; entries[ne].seq = ne;
+				entries[ne].val = entries[ne-1].val; ne++;
+			}
+		}
+	qsort(entries, ne, sizeof(AdjacencyEntry), compare_entries);
+	for (j = 0, nl = 0; j < ne; j++)
+		if ((j+1 == ne) || (entries[j+1].row != entries[j].row) || (entries[j+1].col != entries[j].col))
+			entries[nl++] = entries[j];
+	plhs[0] = mxCreateSparse(g.nnodes, g.nnodes, nl > 0 ? nl : 1, mxREAL);
+	pr = mxGetPr(plhs[0]); ir = mxGetIr(plhs[0]); jc = mxGetJc(plhs[0]);
+	for (i = 0, j = 0; i <= g.nnodes; i++) {
+		while ((j < nl) && (entries[j].col < i)) {
+			ir[j] = entries[j].row;
+			pr[j] = entries[j].val;
+			j++;
+		}
+		jc[i] = j;
+	}
+
+	/********/
+	/* FREE */
+	/********/
+	mxFree(entries);
+	free_skeleton_graph(&g);
+
+}
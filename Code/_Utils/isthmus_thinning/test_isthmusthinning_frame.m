@@ -0,0 +1,28 @@
+function test_isthmusthinning_frame
+
+% Check that the voxels of the frame are never thinned (compile
+% isthmusthinning.c and isthmusthinning_batch.c first): a 2x2 square is set
+% on the last x plane (frame) next to a box, for widths around multiples of
+% 64 (the surface voxels are collected 64 voxels of a row at a time, the
+% last voxel of a row is the first bit of a word for 65 and 129).
+% The square must be left unchanged and the box thinned as without it.
+% Errors out on the first failed check.
+
+if (exist('isthmusthinning_batch','file') ~= 3)||(exist('isthmusthinning','file') ~= 3)
+    error('isthmusthinning MEX files not found, run compile first');
+end
+
+for SizeX = [63 64 65 66 127 128 129 130]
+    M = zeros(SizeX,12,10,'uint8');
+    M(3:end-3,3:end-2,3:end-2) = 1;
+    Box = isthmusthinning(M);
+    M(end,5:6,5:6) = 1;
+    C = isthmusthinning_batch({M},1);
+    O = C{1};
+    assert(all(all(O(end,5:6,5:6) == 1)), sprintf('size_x = %d: frame voxels thinned', SizeX));
+    O(end,5:6,5:6) = 0;
+    assert(isequal(O>0,Box>0), sprintf('size_x = %d: thinning differs next to a non zero frame', SizeX));
+end
+disp('isthmusthinning: frame voxels left unchanged');
+
+end
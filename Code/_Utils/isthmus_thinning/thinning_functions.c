@@ -2,130 +2,219 @@
 *
 *       Name:                thinning_functions.c
 *       Author:              K. Palagyi
-*       Date:                14 November, 2013 
+*       Date:                14 November, 2013
+*
+*       All the state of a thinning run is held in a ThinningContext
+*       (see ibcenterline.h): distinct contexts can be thinned concurrently.
 *
 *******************************************************************************/
 
+static const unsigned char char_mask[8] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+
+/* index of the lowest set bit of a non zero word, number of set bits */
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  #pragma intrinsic(_BitScanForward64)
+  static int lowest_bit(unsigned long long w) { unsigned long i; _BitScanForward64(&i, w); return (int)i; }
+  #define bit_count(w)       ((int)__popcnt64(w))
+#else
+  #define lowest_bit(w)      __builtin_ctzll(w)
+  #define bit_count(w)       __builtin_popcountll(w)
+#endif
+
+/*========= function init_thinning_context =========*/
+/* image is a framed volume (object voxels set to 1, 1 voxel background frame),
+   it is thinned in place; the LUTs can be shared by several contexts */
+void init_thinning_context(ThinningContext *ctx,
+                           unsigned char *image,
+                           unsigned long int size_x,
+                           unsigned long int size_y,
+                           unsigned long int size_z,
+                           const unsigned char *lut_simple,
+                           const unsigned char *lut_isthmus) {
+	ctx->image       = image;
+	ctx->size_x      = size_x;
+	ctx->size_y      = size_y;
+	ctx->size_z      = size_z;
+	ctx->size_xy     = size_x * size_y;
+	ctx->size_xyz    = ctx->size_xy * size_z;
+	ctx->lut_simple  = lut_simple;
+	ctx->lut_isthmus = lut_isthmus;
+	ctx->SurfaceVoxels.voxel    = NULL;
+	ctx->SurfaceVoxels.length   = 0;
+	ctx->SurfaceVoxels.capacity = 0;
+	ctx->SurfaceVoxels.removed  = 0;
+	ctx->Candidates.pos         = NULL;
+	ctx->Candidates.length      = 0;
+	ctx->Candidates.capacity    = 0;
+	ctx->bits                   = NULL;
+	ctx->words_per_row          = (size_x+63)/64;
+	ctx->neighbours  = 0;
+	ctx->direction   = 0;
+	ctx->failed      = 0;
+}
+/*========= end of function init_thinning_context =========*/
+
+/*=======================================*/
+/*========= bit plane functions =========*/
+/*=======================================*/
+
+/* pack the object voxels of the image in bit rows, returns 0 (ctx->failed
+   set) if they cannot be allocated */
+int build_bitplanes(ThinningContext *ctx) {
+unsigned long int row, x, nrows = ctx->size_y*ctx->size_z;
+const unsigned char *image = ctx->image;
+unsigned long long *bits;
+	ctx->bits = (unsigned long long *)calloc(nrows*ctx->words_per_row, sizeof(unsigned long long));
+	if (ctx->bits == NULL) {
+		ctx->failed = 1;
+		return 0;
+	}
+	for (row=0, bits=ctx->bits; row<nrows; row++, image+=ctx->size_x, bits+=ctx->words_per_row)
+		for (x=0; x<ctx->size_x; x++)
+			if (image[x]) bits[x>>6] |= 1ULL<<(x&63);
+	return 1;
+}
+
+void free_bitplanes(ThinningContext *ctx) {
+	free(ctx->bits);
+	ctx->bits = NULL;
+}
+
+/* delete voxel k from the image and the bit rows */
+void delete_voxel(ThinningContext *ctx, unsigned long int k) {
+unsigned long int row = k / ctx->size_x, x = k - row*ctx->size_x;
+	*(ctx->image + k) = 0;
+	ctx->bits[row*ctx->words_per_row + (x>>6)] &= ~(1ULL<<(x&63));
+}
+
+/* bits x-1, x, x+1 of a bit row (1 <= x <= size_x-2) */
+static unsigned long int row3(const unsigned long long *bits, unsigned long int x) {
+unsigned long int b = x-1, s = b&63;
+unsigned long long w = bits[b>>6] >> s;
+	if (s > 61) w |= bits[(b>>6)+1] << (64-s);
+	return (unsigned long int)(w & 7);
+}
+
 /*==================================*/
 /*========= list functions =========*/
 /*==================================*/
 
-void NewSurfaceVoxel(unsigned long int x,
-                     unsigned long int y,
-		     unsigned long int z) {
-ListElement * LE;
-	LE=(ListElement *)malloc(sizeof(ListElement));
-	(*LE).x=x;
-	(*LE).y=y;
-	(*LE).z=z;
-	(*LE).next=NULL;
-	(*LE).prev=SurfaceVoxels.last;
-	if (SurfaceVoxels.last!=NULL) (*((ListElement*)(SurfaceVoxels.last))).next=LE;
-	SurfaceVoxels.last=LE;
-	if (SurfaceVoxels.first==NULL) SurfaceVoxels.first=LE;
+/* grow an array of unsigned long int to hold at least n entries, returns 0
+   (array and capacity unchanged) if it cannot be reallocated */
+static int GrowArray(unsigned long int **array,
+                     unsigned long int *capacity,
+                     unsigned long int n) {
+unsigned long int c;
+unsigned long int *a;
+	if (n <= *capacity) return 1;
+	c = (*capacity < 1024) ? 1024 : *capacity;
+	while (c < n) c *= 2;
+	a = (unsigned long int *)realloc(*array, c*sizeof(unsigned long int));
+	if (a == NULL) return 0;
+	*array = a;
+	*capacity = c;
+	return 1;
 }
 
-void RemoveSurfaceVoxel(ListElement * LE) {
-ListElement * LE2;
-	if (SurfaceVoxels.first==LE) SurfaceVoxels.first=(*LE).next;
-	if (SurfaceVoxels.last==LE) SurfaceVoxels.last=(*LE).prev;
-	if ((*LE).next!=NULL) {
-		LE2=(ListElement*)((*LE).next);
-		(*LE2).prev=(*LE).prev;
-	}
-	if ((*LE).prev!=NULL) {
-		LE2=(ListElement*)((*LE).prev);
-		(*LE2).next=(*LE).next;
-	}
-	free(LE);
+/* returns 0 if the list cannot grow */
+int AppendVoxel(SurfaceList *L, unsigned long int k) {
+	if (! GrowArray(&L->voxel, &L->capacity, L->length+1)) return 0;
+	L->voxel[L->length++] = k;
+	return 1;
 }
 
-void CreatePointList(PointList *s) {
-	s->Head=NULL;
-	s->Tail=NULL;
-	s->Length=0;
+void NewSurfaceVoxel(ThinningContext *ctx, unsigned long int k) {
+	if (! AppendVoxel(&ctx->SurfaceVoxels, k)) ctx->failed = 1;
 }
 
-void AddToList(PointList *s,Voxel e, ListElement * ptr) {
-Cell * newcell;
-	newcell=(Cell *)malloc(sizeof(Cell));
-	newcell->v=e;
-	newcell->ptr=ptr;
-	newcell->next=NULL;
-	if (s->Head==NULL) {
-		s->Head=newcell;
-		s->Tail=newcell;
-		s->Length=1;
-	}
-	else {
-		s->Tail->next=newcell;
-		s->Tail=newcell;
-		s->Length++;
-	}
+void RemoveSurfaceVoxel(ThinningContext *ctx, unsigned long int pos) {
+	ctx->SurfaceVoxels.voxel[pos] = REMOVED;
+	ctx->SurfaceVoxels.removed++;
 }
 
-Voxel GetFromList(PointList *s, ListElement **ptr) {
-Voxel R;    
-Cell *tmp;
-        R.i = -1;
-        R.j = -1;
-        R.k = -1;
-	(*ptr)=NULL;
-	if(s->Length==0) return R;
-	else {
-		R=s->Head->v;
-		(*ptr)=s->Head->ptr;
-		tmp=(Cell *)s->Head->next;
-		free(s->Head);
-		s->Head=tmp;
-		s->Length--;
-		if(s->Length==0) {
-			s->Head=NULL;
-			s->Tail=NULL;
-		}
-		return R;
-	}
+/* squeeze the tombstones out (order preserved), only called when no
+   candidate refers to a position of the surface list */
+void CompactVoxels(SurfaceList *L) {
+unsigned long int i, n;
+	if (2*L->removed <= L->length) return;
+	for (i=0, n=0; i<L->length; i++)
+		if (L->voxel[i] != REMOVED) L->voxel[n++] = L->voxel[i];
+	L->length  = n;
+	L->removed = 0;
 }
 
-void DestroyPointList(PointList *s) {
-ListElement * ptr;
-	while(s->Length>0) GetFromList(s, &ptr);
+void CompactSurfaceVoxels(ThinningContext *ctx) {
+	CompactVoxels(&ctx->SurfaceVoxels);
 }
 
-void CollectSurfaceVoxels(void) {
-unsigned long int x,y,z;
+/* release the storage of the context lists */
+void DestroySurfaceVoxels(ThinningContext *ctx) {
+	free(ctx->SurfaceVoxels.voxel);
+	free(ctx->Candidates.pos);
+	ctx->SurfaceVoxels.voxel    = NULL;
+	ctx->SurfaceVoxels.length   = 0;
+	ctx->SurfaceVoxels.capacity = 0;
+	ctx->SurfaceVoxels.removed  = 0;
+	ctx->Candidates.pos         = NULL;
+	ctx->Candidates.length      = 0;
+	ctx->Candidates.capacity    = 0;
+}
 
-  SurfaceVoxels.first = NULL;
-  SurfaceVoxels.last  = NULL;
+void AddCandidate(ThinningContext *ctx, unsigned long int pos) {
+CandidateList *C = &ctx->Candidates;
+	if (! GrowArray(&C->pos, &C->capacity, C->length+1)) {
+		ctx->failed = 1;
+		return;
+	}
+	C->pos[C->length++] = pos;
+}
 
-  for( z=1, z_size_xy=size_xy;
-       z<size_z-1;
-       z++, z_size_xy+=size_xy )
-    {
-      zm_size_xy = z_size_xy - size_xy;
-      zp_size_xy = z_size_xy + size_xy;
-      for( y=1, y_size_x=size_x;
-           y<size_y-1;
-           y++, y_size_x+=size_x )
-        {
-          ym_size_x  = y_size_x - size_x;
-          yp_size_x  = y_size_x + size_x;
-          for(x=1; x<size_x-1; x++)
-            if ( *(image + x + y_size_x + z_size_xy ) )
+/* surface voxels: object voxels with a background 6-neighbour, 64 voxels of a
+   row at a time from the bit rows (collected in image order) */
+void CollectSurfaceVoxels(ThinningContext *ctx) {
+unsigned long int y, z, w, x, row;
+unsigned long long cur, left, right, surf, first, last;
+const unsigned long long *r, *rym, *ryp, *rzm, *rzp;
+unsigned char *image = ctx->image;
+const unsigned long int size_x = ctx->size_x, size_y = ctx->size_y, size_z = ctx->size_z;
+const unsigned long int wpr = ctx->words_per_row, zstride = size_y*wpr;
+
+  ctx->SurfaceVoxels.length  = 0;
+  ctx->SurfaceVoxels.removed = 0;
+
+  /* voxels x = 1 .. size_x-2 only: the last word holds voxels up to size_x-1
+     (none of it is collected if voxel size_x-1 is its first bit) */
+  first = ~1ULL;
+  last  = ( 1ULL<<((size_x-1)&63) ) - 1;
+
+  for( z=1; z<size_z-1; z++ )
+    for( y=1; y<size_y-1; y++ )
+      {
+        row = y + z*size_y;
+        r   = ctx->bits + row*wpr;
+        rym = r - wpr;     ryp = r + wpr;
+        rzm = r - zstride; rzp = r + zstride;
+        for( w=0; w<wpr; w++ )
+          {
+            cur = r[w];
+            if ( w == 0 ) cur &= first;
+            if ( w == (size_x-1)>>6 ) cur &= last;
+            if ( w > (size_x-1)>>6 ) cur = 0;
+            if ( cur == 0 ) continue;
+            left  = ( r[w] << 1 ) | ( ( w > 0 ) ? ( r[w-1] >> 63 ) : 0 );       /* bit x: voxel x-1 */
+            right = ( r[w] >> 1 ) | ( ( w+1 < wpr ) ? ( r[w+1] << 63 ) : 0 );   /* bit x: voxel x+1 */
+            surf  = cur & ~( left & right & rym[w] & ryp[w] & rzm[w] & rzp[w] );
+            while ( surf )
               {
-                if (  ( *(image +   x + ym_size_x +  z_size_xy ) ==0 ) ||
-                      ( *(image +   x + yp_size_x +  z_size_xy ) ==0 ) ||
-                      ( *(image +   x +  y_size_x + zm_size_xy ) ==0 ) ||
-                      ( *(image +   x +  y_size_x + zp_size_xy ) ==0 ) ||
-                      ( *(image + x+1 +  y_size_x +  z_size_xy ) ==0 ) ||
-                      ( *(image + x-1 +  y_size_x +  z_size_xy ) ==0 )    )
-                   {
-                      *(image + x + y_size_x + z_size_xy ) = 2;
-                      NewSurfaceVoxel(x,y,z);
-                   } /* endif */
-              } /* endif */
-        } /* endfor y */
-    } /* endfor z */
+                x = (w<<6) + lowest_bit(surf);
+                surf &= surf-1;
+                *(image + x + row*size_x) = 2;
+                NewSurfaceVoxel(ctx, x + row*size_x);
+              }
+          }
+      }
 
 }
 
@@ -133,10 +222,9 @@ unsigned long int x,y,z;
 /*========= functions concerning topological properties =========*/
 /*===============================================================*/
 
-/*========= function collect_26_neighbours =========*/
-void collect_26_neighbours(unsigned long int x,
-                           unsigned long int y,
-                           unsigned long int z )
+/*========= function neighbourhood_code =========*/
+unsigned long int neighbourhood_code(const ThinningContext *ctx,
+                                     unsigned long int k )
   {
     /*
       indices in "neighbours":
@@ -144,213 +232,147 @@ void collect_26_neighbours(unsigned long int x,
       3  4  5    12    13     20 21 22     y
       6  7  8    14 15 16     23 24 25    y+1
      x-1 x x+1   x-1 x x+1    x-1 x x+1
-        z-1          z           z+1 
+        z-1          z           z+1
+      each 3 bits of a row are read at once from the bit rows
     */
+    const unsigned long int row = k / ctx->size_x, x = k - row*ctx->size_x;
+    const unsigned long int wpr = ctx->words_per_row, zstride = ctx->size_y*wpr;
+    const unsigned long long *r = ctx->bits + row*wpr;
+    unsigned long int zm, z0, zp, mid;
 
-    z_size_xy  = z*size_xy;
-    zm_size_xy = z_size_xy - size_xy;
-    zp_size_xy = z_size_xy + size_xy;
-    y_size_x   = y*size_x;
-    ym_size_x  = y_size_x  - size_x;
-    yp_size_x  = y_size_x  + size_x;
-
-    neighbours = 0x00000000;
-
-    if ( *(image + x-1 + ym_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 0];
-    if ( *(image +   x + ym_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 1];
-    if ( *(image + x+1 + ym_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 2];
-    if ( *(image + x-1 +  y_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 3];
-    if ( *(image +   x +  y_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 4];
-    if ( *(image + x+1 +  y_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 5];
-    if ( *(image + x-1 + yp_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 6];
-    if ( *(image +   x + yp_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 7];
-    if ( *(image + x+1 + yp_size_x + zm_size_xy ) )
-        neighbours |= long_mask[ 8];
-
-    if ( *(image + x-1 + ym_size_x +  z_size_xy ) )
-        neighbours |= long_mask[ 9];
-    if ( *(image +   x + ym_size_x +  z_size_xy ) )
-        neighbours |= long_mask[10];
-    if ( *(image + x+1 + ym_size_x +  z_size_xy ) )
-        neighbours |= long_mask[11];
-    if ( *(image + x-1 +  y_size_x +  z_size_xy ) )
-        neighbours |= long_mask[12];
-    if ( *(image + x+1 +  y_size_x +  z_size_xy ) )
-        neighbours |= long_mask[13];
-    if ( *(image + x-1 + yp_size_x +  z_size_xy ) )
-        neighbours |= long_mask[14];
-    if ( *(image +   x + yp_size_x +  z_size_xy ) )
-        neighbours |= long_mask[15];
-    if ( *(image + x+1 + yp_size_x +  z_size_xy ) )
-        neighbours |= long_mask[16];
-
-    if ( *(image + x-1 + ym_size_x + zp_size_xy ) )
-        neighbours |= long_mask[17];
-    if ( *(image +   x + ym_size_x + zp_size_xy ) )
-        neighbours |= long_mask[18];
-    if ( *(image + x+1 + ym_size_x + zp_size_xy ) )
-        neighbours |= long_mask[19];
-    if ( *(image + x-1 +  y_size_x + zp_size_xy ) )
-        neighbours |= long_mask[20];
-    if ( *(image +   x +  y_size_x + zp_size_xy ) )
-        neighbours |= long_mask[21];
-    if ( *(image + x+1 +  y_size_x + zp_size_xy ) )
-        neighbours |= long_mask[22];
-    if ( *(image + x-1 + yp_size_x + zp_size_xy ) )
-        neighbours |= long_mask[23];
-    if ( *(image +   x + yp_size_x + zp_size_xy ) )
-        neighbours |= long_mask[24];
-    if ( *(image + x+1 + yp_size_x + zp_size_xy ) )
-        neighbours |= long_mask[25];
+    zm  = row3(r-zstride-wpr, x) | row3(r-zstride, x)<<3 | row3(r-zstride+wpr, x)<<6;
+    zp  = row3(r+zstride-wpr, x) | row3(r+zstride, x)<<3 | row3(r+zstride+wpr, x)<<6;
+    mid = row3(r, x);
+    z0  = row3(r-wpr, x) | ( (mid&1) | (mid>>2)<<1 )<<3 | row3(r+wpr, x)<<5;
 
+    return zm | z0<<9 | zp<<17;
+  }
+/*========= end of function neighbourhood_code =========*/
+
+
+/*========= function collect_26_neighbours =========*/
+void collect_26_neighbours(ThinningContext *ctx,
+                           unsigned long int k )
+  {
+    ctx->neighbours = neighbourhood_code(ctx, k);
   }
 /*========= end of function collect_26_neighbours =========*/
 
 
+/*========= function lut_bit =========*/
+int lut_bit( const unsigned char *lut, unsigned long int neighbours )
+{
+  return ( ( *(lut + (neighbours>>3) ) ) & char_mask[neighbours%8]);
+}
+/*========= end of function lut_bit =========*/
+
+
 /*========= function simple_26_6 =========*/
-int simple_26_6( void )
+int simple_26_6( const ThinningContext *ctx )
 {
-  return ( ( *(lut_simple + (neighbours>>3) ) ) & char_mask[neighbours%8]);
+  return lut_bit(ctx->lut_simple, ctx->neighbours);
 }
 /*========= end of function simple_26_6 =========*/
 
 
 /*========= function isthmus =========*/
-int isthmus( void )	      
+int isthmus( const ThinningContext *ctx )
 {
-  return ( ( *(lut_isthmus + (neighbours>>3) ) ) & char_mask[neighbours%8]);
+  return lut_bit(ctx->lut_isthmus, ctx->neighbours);
 }
 /*========= end of function isthmus =========*/
 
 
 /*=========== function DetectSimpleBorderPoints ===========*/
-void DetectSimpleBorderPoints(PointList *s) {
+void DetectSimpleBorderPoints(ThinningContext *ctx) {
 unsigned char value;
-Voxel v;
-ListElement * LE3;
-unsigned long int x, y, z, num;
+unsigned long int pos, k;
+unsigned char *image = ctx->image;
+const unsigned long int size_x = ctx->size_x, size_xy = ctx->size_xy;
+const SurfaceList *L = &ctx->SurfaceVoxels;
 
-  LE3=(ListElement *)SurfaceVoxels.first;			
-  while (LE3!=NULL)
+  ctx->Candidates.length = 0;
+  for ( pos=0; pos<L->length; pos++ )
     {
-      x         = (*LE3).x;
-      y         = (*LE3).y;
-      z         = (*LE3).z;
-      y_size_x  = y*size_x;
-      z_size_xy = z*size_xy;           
-      if ( *(image + x + y_size_x + z_size_xy) == 2 )   /* not an isthmus */
+      k = L->voxel[pos];
+      if ( k == REMOVED ) continue;
+      if ( *(image + k) == 2 )   /* not an isthmus */
         {
-          ym_size_x  = y_size_x  - size_x;
-          yp_size_x  = y_size_x  + size_x;
-          zm_size_xy = z_size_xy - size_xy;
-          zp_size_xy = z_size_xy + size_xy;
-          switch( direction )
+          switch( ctx->direction )
             {
-              case U: value = *(image + x   + ym_size_x + z_size_xy  );
+              case U: value = *(image + k - size_x  );
                       break;
-              case D: value = *(image + x   + yp_size_x + z_size_xy  );
+              case D: value = *(image + k + size_x  );
                       break;
-              case N: value = *(image + x   + y_size_x  + zm_size_xy );
+              case N: value = *(image + k - size_xy );
                       break;
-              case S: value = *(image + x   + y_size_x  + zp_size_xy );
+              case S: value = *(image + k + size_xy );
                       break;
-              case E: value = *(image + x+1 + y_size_x  + z_size_xy  );
+              case E: value = *(image + k + 1       );
                       break;
-              case W: value = *(image + x-1 + y_size_x  + z_size_xy  );
+              case W: value = *(image + k - 1       );
                       break;
             } /* endswitch */
           if( value == 0 )
             {
-	      collect_26_neighbours(x,y,z); 
-              if ( simple_26_6() )
+	      collect_26_neighbours(ctx,k);
+              if ( simple_26_6(ctx) )
                 {
-                  v.i = x;
-                  v.j = y;
-                  v.k = z;
-                  AddToList(s,v,LE3);
+                  AddCandidate(ctx,pos);
                 } /* endif */
                else
 	        {
-	           if ( isthmus() )
+	           if ( isthmus(ctx) )
 	             {
-		       *(image + x + y_size_x + z_size_xy) = 3;
+		       *(image + k) = 3;
         	     }  /* endif */
 		}  /* endelse */
-            } /* endif */    
+            } /* endif */
         } /* endif */
-      LE3=(ListElement *)(*LE3).next;
-    } /* endwhile */
+    } /* endfor */
 
 }
 /*=========== end of function DetectSimpleBorderPoints ===========*/
 
 
 /*========= function thinning_iteration_step =========*/
-unsigned int thinning_iteration_step(void)
+unsigned int thinning_iteration_step(ThinningContext *ctx)
 {
-  unsigned long int changed;
-  ListElement *ptr;
-  PointList s;
-  Voxel v;
- 
+  unsigned long int changed, c, pos, k;
+  unsigned char *image = ctx->image;
+  const unsigned long int size_x = ctx->size_x, size_xy = ctx->size_xy;
+  unsigned long int offset[6];   /* 6-neighbours: x-1, x+1, y-1, y+1, z-1, z+1 */
+  int o;
+
+  offset[0] = -1;      offset[1] = 1;
+  offset[2] = -size_x; offset[3] = size_x;
+  offset[4] = -size_xy; offset[5] = size_xy;
+
   changed = 0;
-  for ( direction=0; direction<6; direction++ )
+  for ( ctx->direction=0; ctx->direction<6; ctx->direction++ )
     {
-      CreatePointList(&s);
-      DetectSimpleBorderPoints(&s);
-      while ( s.Length > 0 )
+      CompactSurfaceVoxels(ctx);
+      DetectSimpleBorderPoints(ctx);
+      if ( ctx->failed ) return 0;   /* allocation failure: stop the thinning */
+      for ( c=0; c<ctx->Candidates.length; c++ )
         {
-           v = GetFromList( &s, &ptr );	
-	   collect_26_neighbours( v.i, v.j, v.k ); 	      
-           if ( simple_26_6() )
+           pos = ctx->Candidates.pos[c];
+           k   = ctx->SurfaceVoxels.voxel[pos];
+	   collect_26_neighbours( ctx, k );
+           if ( simple_26_6(ctx) )
              {
-               z_size_xy = (v.k)*size_xy;
-               y_size_x  = (v.j)*size_x;		 
-               *(image + v.i + y_size_x + z_size_xy ) = 0; /* simple point is deleted */    
+               delete_voxel(ctx, k); /* simple point is deleted */
                changed ++;
                /* investigating v's 6-neighbours */
-               if (*(image + v.i-1 + y_size_x + z_size_xy                )==1)
-                 {
-                   NewSurfaceVoxel( v.i-1, v.j  , v.k   );
-                   *(image + v.i-1 + y_size_x + z_size_xy                ) = 2;
-                 }
-               if (*(image + v.i+1 + y_size_x        + z_size_xy         )==1)
-                 {
-                   NewSurfaceVoxel( v.i+1, v.j  , v.k   );
-                   *(image + v.i+1 + y_size_x        + z_size_xy         ) = 2;
-                 }
-               if (*(image + v.i   + y_size_x-size_x + z_size_xy         )==1)
-                 {
-                   NewSurfaceVoxel( v.i  , v.j-1, v.k   );
-                   *(image + v.i   + y_size_x-size_x + z_size_xy         ) = 2;
-                 }
-               if (*(image + v.i   + y_size_x+size_x + z_size_xy         )==1)
-                 {
-                   NewSurfaceVoxel( v.i  , v.j+1, v.k   );
-                   *(image + v.i   + y_size_x+size_x + z_size_xy         ) = 2;
-                 }
-               if (*(image + v.i   + y_size_x        + z_size_xy-size_xy )==1)
-                 {
-                   NewSurfaceVoxel( v.i  , v.j  , v.k-1 );
-                   *(image + v.i   + y_size_x        + z_size_xy-size_xy ) = 2;
-                 }
-               if (*(image + v.i   + y_size_x        + z_size_xy+size_xy )==1)
-                 {
-                   NewSurfaceVoxel( v.i  , v.j  , v.k+1 );
-                   *(image + v.i   + y_size_x        + z_size_xy+size_xy ) = 2;
-                 }
-               RemoveSurfaceVoxel(ptr);
+               for ( o=0; o<6; o++ )
+                 if (*(image + k + offset[o])==1)
+                   {
+                     NewSurfaceVoxel( ctx, k + offset[o] );
+                     *(image + k + offset[o]) = 2;
+                   }
+               RemoveSurfaceVoxel(ctx, pos);
              } /* endif */
-        } /* endwhile */
-      DestroyPointList(&s);
+        } /* endfor */
     } /* endfor */
 
   return changed;
@@ -358,21 +380,143 @@ unsigned int thinning_iteration_step(void)
 /*========= end of function thinning_iteration_step =========*/
 
 /*========= function sequential_thinning =========*/
-void sequential_thinning(void)
+void sequential_thinning(ThinningContext *ctx)
 {
   unsigned int iter, changed;
 
-  CollectSurfaceVoxels();
+  if ( (ctx->size_x < 3) || (ctx->size_y < 3) || (ctx->size_z < 3) )
+    return;   /* nothing inside the frame */
+
+  if ( ! build_bitplanes(ctx) ) return;
+  CollectSurfaceVoxels(ctx);
 
   iter = 0;
-  changed = 1;
+  changed = ! ctx->failed;
   while ( changed )
     {
-      changed = thinning_iteration_step();
+      changed = thinning_iteration_step(ctx);
       iter++;
       //printf("\n  iteration step: %3d.    (deleted point(s): %6d)",
-      //       iter, changed );     
+      //       iter, changed );
     }
 
+  DestroySurfaceVoxels(ctx);
+  free_bitplanes(ctx);
 }
 /*========= end of function sequential_thinning =========*/
+
+
+/*========= function subfield_thinning =========*/
+/* parallel mode: the voxels are split in the 8 subfields of equal coordinate
+   parities, no two voxels of a subfield are 26-adjacent. The surface voxels of
+   a subfield are classified concurrently against the unchanged image (simple:
+   deleted, isthmus: kept as 3), then all its simple voxels are deleted at once,
+   which preserves the topology since deleting one of them cannot change the
+   neighbourhood of another. The output does not depend on the number of
+   threads (but differs from sequential_thinning). */
+#define SUBFIELD_KEEP      0
+#define SUBFIELD_DELETE    1
+#define SUBFIELD_ISTHMUS   2
+
+static int subfield(const ThinningContext *ctx, unsigned long int k)
+{
+  return (int)( ( k % ctx->size_x ) & 1 ) |
+         (int)( ( ( k / ctx->size_x ) % ctx->size_y ) & 1 ) << 1 |
+         (int)( ( k / ctx->size_xy ) & 1 ) << 2;
+}
+
+void subfield_thinning(ThinningContext *ctx, int nthreads)
+{
+  SurfaceList sub[8];
+  unsigned char *decision = NULL;
+  unsigned long int decision_capacity = 0;
+  unsigned long int changed, pos, k, offset[6];
+  unsigned char *image = ctx->image;
+  long long p, n;
+  int f, o;
+
+  if ( (ctx->size_x < 3) || (ctx->size_y < 3) || (ctx->size_z < 3) )
+    return;   /* nothing inside the frame */
+
+  offset[0] = -1;           offset[1] = 1;
+  offset[2] = -ctx->size_x;  offset[3] = ctx->size_x;
+  offset[4] = -ctx->size_xy; offset[5] = ctx->size_xy;
+
+  /* surface voxels dispatched to their subfield */
+  if ( ! build_bitplanes(ctx) ) return;
+  CollectSurfaceVoxels(ctx);
+  for ( f=0; f<8; f++ )
+    {
+      sub[f].voxel = NULL;
+      sub[f].length = sub[f].capacity = sub[f].removed = 0;
+    }
+  for ( pos=0; pos<ctx->SurfaceVoxels.length; pos++ )
+    if ( ! AppendVoxel( &sub[subfield(ctx, ctx->SurfaceVoxels.voxel[pos])], ctx->SurfaceVoxels.voxel[pos] ) )
+      ctx->failed = 1;
+  DestroySurfaceVoxels(ctx);
+
+  changed = ! ctx->failed;
+  while ( changed )
+    {
+      changed = 0;
+      for ( f=0; ( f<8 ) && ( ! ctx->failed ); f++ )
+        {
+          CompactVoxels(&sub[f]);
+          n = (long long)sub[f].length;
+          if ( sub[f].length > decision_capacity )
+            {
+              unsigned char *d = (unsigned char *)realloc(decision, 2*sub[f].length);
+              if ( d == NULL )
+                {
+                  ctx->failed = 1;   /* allocation failure: stop the thinning */
+                  break;
+                }
+              decision = d;
+              decision_capacity = 2*sub[f].length;
+            }
+
+          /* classify (the image is only read) */
+          #pragma omp parallel for schedule(dynamic,4096) num_threads(nthreads)
+          for ( p=0; p<n; p++ )
+            {
+              unsigned long int v = sub[f].voxel[p], code;
+              decision[p] = SUBFIELD_KEEP;
+              if ( ( v == REMOVED ) || ( *(image + v) != 2 ) ) continue;
+              code = neighbourhood_code(ctx, v);
+              if ( lut_bit(ctx->lut_simple, code) ) decision[p] = SUBFIELD_DELETE;
+              else if ( lut_bit(ctx->lut_isthmus, code) ) decision[p] = SUBFIELD_ISTHMUS;
+            }
+
+          /* delete the simple voxels, their object 6-neighbours become surface voxels */
+          for ( pos=0; pos<sub[f].length; pos++ )
+            {
+              k = sub[f].voxel[pos];
+              if ( decision[pos] == SUBFIELD_ISTHMUS )
+                {
+                  *(image + k) = 3;
+                  sub[f].voxel[pos] = REMOVED;
+                  sub[f].removed++;
+                }
+              else if ( decision[pos] == SUBFIELD_DELETE )
+                {
+                  delete_voxel(ctx, k);
+                  changed++;
+                  sub[f].voxel[pos] = REMOVED;
+                  sub[f].removed++;
+                  for ( o=0; o<6; o++ )
+                    if ( *(image + k + offset[o]) == 1 )
+                      {
+                        if ( ! AppendVoxel( &sub[subfield(ctx, k + offset[o])], k + offset[o] ) )
+                          ctx->failed = 1;
+                        *(image + k + offset[o]) = 2;
+                      }
+                }
+            }
+        }
+    }
+
+  for ( f=0; f<8; f++ ) free(sub[f].voxel);
+  free(decision);
+  free_bitplanes(ctx);
+}
+/*========= end of function subfield_thinning =========*/
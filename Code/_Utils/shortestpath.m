@@ -5,7 +5,8 @@ function ShortestLine=shortestpath(DistanceMap,StartPoint,SourcePoint,Stepsize,M
 % ShortestLine=shortestpath(DistanceMap,StartPoint,SourcePoint,Stepsize,Method)
 % 
 % inputs,
-%   DistanceMap : A 2D or 3D distance map (from the functions msfm2d or msfm3d)
+%   DistanceMap : A 2D or 3D distance map (from the functions msfm2d or msfm3d,
+%                 or geodesicdistance)
 %   StartPoint : Start point of the shortest path
 %   SourcePoint : (Optional), End point of the shortest path
 %   Stepsize: (Optional), Line trace step size 
@@ -39,6 +40,18 @@ if(~exist('Stepsize','var')), Stepsize=0.5; end
 if(~exist('SourcePoint','var')), SourcePoint=[]; end
 if(~exist('Method','var')), Method='rk4'; end
 
+% Native tracer (compile rk4paths.cpp), same loop without a MEX call per step,
+% the gradient of pointmin is computed on the fly from the distance map
+if(strcmpi(Method,'rk4')&&(exist('rk4paths','file')==3))
+    if(~isa(DistanceMap,'single')), DistanceMap=double(DistanceMap); end
+    [ShortestLine,DistancetoEnd]=rk4paths(DistanceMap,StartPoint(:),double(SourcePoint),Stepsize);
+    ShortestLine=ShortestLine{1};
+    if((DistancetoEnd>1)&&(~isempty(SourcePoint)))
+        disp('The shortest path trace did not finish at the source point');
+    end
+    return;
+end
+
 % Calculate gradient of DistanceMap
 if(ndims(DistanceMap)==2) % Select 2D or 3D
     [Fy,Fx] = pointmin(DistanceMap);
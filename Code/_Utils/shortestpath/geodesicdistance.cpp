@@ -0,0 +1,254 @@
+#include <math.h>
+#include <string.h>
+#include "matrix.h"
+#include "mex.h"
+#include <vector>
+#include <queue>
+#include <functional>
+
+// [DistanceMap, Labels] = geodesicdistance(Mask, Seeds, Speed, Spacing, Method)
+//
+// Geodesic distance (travel time) from a set of seeds in a 2D or 3D domain, grown from the seeds
+// with a narrow band held in a heap: every voxel is accepted once, in increasing distance order.
+// Mask: logical domain (voxels the distance can travel through), [] for the whole image
+// Seeds: logical mask of the seeds (label of a seed: its rank in linear index order), or label
+//        image (uint8, uint16, uint32, single or double, non zero: seed and its label), it gives
+//        the size of the image. Seeds outside of Mask are ignored.
+// Speed (optional): [] for a uniform speed of 1 (default), or speed image (single or double),
+//        voxels with a speed <= 0 are not part of the domain
+// Spacing (optional): voxel size along each dimension of the array, default [1 1 1]
+// Method (optional):
+//   'fmm' (default): fast marching, first order upwind solution of |grad(D)|*Speed = 1
+//   'quasi-euclidean', 'chessboard', 'cityblock': shortest path along the 8 (26), 8 (26) or 4 (6)
+//   neighbours, same distances as bwdistgeodesic for a uniform speed. With a speed image the
+//   cost of a step is its length times the mean of the inverse speed at both ends.
+// DistanceMap: single, NaN outside of the domain, Inf for the voxels no seed can reach
+// Labels (optional): uint32, label of the seed the voxel is closest to (0 if unreached)
+//
+// Typical use: distance map for shortestpath (Method 'fmm'), geodesic slicing of a mask.
+
+#define STATE_FAR 0
+#define STATE_ACCEPTED 1
+#define STATE_OUTSIDE 2
+
+#define METHOD_FMM 0
+#define METHOD_QUASI_EUCLIDEAN 1
+#define METHOD_CHESSBOARD 2
+#define METHOD_CITYBLOCK 3
+
+typedef std::pair<double, long long> BandEntry;
+typedef std::priority_queue<BandEntry, std::vector<BandEntry>, std::greater<BandEntry> > NarrowBand;
+
+struct GeodesicVolume
+{
+	long long size[3], stride[3], n;
+	int ndim;
+	double spacing[3];
+	std::vector<unsigned char> state;
+	std::vector<double> dist;
+	std::vector<unsigned int> label;
+	const void *speed;
+	bool single;
+};
+
+// Inverse speed (time to travel a unit length) at voxel i
+static double slowness(const GeodesicVolume &v, long long i)
+{
+	if(v.speed == NULL) return 1.0;
+	if(v.single) return 1.0/((const float *)v.speed)[i];
+	return 1.0/((const double *)v.speed)[i];
+}
+
+// First order upwind update of voxel i from its accepted neighbours (closest accepted neighbour
+// along each dimension, the dimensions with the largest distances are dropped when the solution
+// is not above them), label of the closest neighbour in lab
+static double fmm_update(const GeodesicVolume &v, long long i, const long long *c, unsigned int *lab)
+{
+	double t[3], h[3], a = 0, b = 0, q = 0, f = slowness(v, i), s = HUGE_VAL, r;
+	long long j, jd;
+	int d, k, m = 0;
+
+	for(d=0;d<v.ndim;d++)
+	{
+		jd = -1;
+		if((c[d] > 0)&&(v.state[i-v.stride[d]] == STATE_ACCEPTED)) jd = i-v.stride[d];
+		j = i+v.stride[d];
+		if((c[d] < v.size[d]-1)&&(v.state[j] == STATE_ACCEPTED)&&((jd < 0)||(v.dist[j] < v.dist[jd]))) jd = j;
+		if(jd < 0) continue;
+		if((m == 0)||(v.dist[jd] < t[0])) *lab = v.label[jd];
+		// Insertion in increasing order
+		for(k=m;(k > 0)&&(t[k-1] > v.dist[jd]);k--) { t[k] = t[k-1]; h[k] = h[k-1]; }
+		t[k] = v.dist[jd]; h[k] = v.spacing[d];
+		m++;
+	}
+
+	for(k=0;k<m;k++)
+	{
+		if(s <= t[k]) break;
+		a += 1.0/(h[k]*h[k]);
+		b += t[k]/(h[k]*h[k]);
+		q += t[k]*t[k]/(h[k]*h[k]);
+		r = b*b-a*(q-f*f);
+		if(r < 0) break;
+		s = (b+sqrt(r))/a;
+	}
+	return s;
+}
+
+// Accept the voxels of the narrow band in increasing distance order and update their neighbours.
+// Fast marching first sets the 8 (26) neighbours of the seeds to their straight line distance:
+// the upwind scheme alone overestimates the distance close to a point source.
+static void grow(GeodesicVolume &v, NarrowBand &band, int method)
+{
+	long long c[3], i, j;
+	int o[3], d;
+
+	while(!band.empty())
+	{
+		BandEntry e = band.top();
+		band.pop();
+		i = e.second;
+		if((v.state[i] != STATE_FAR)||(e.first > v.dist[i])) continue;
+		v.state[i] = STATE_ACCEPTED;
+		c[0] = i%v.size[0]; c[1] = (i/v.size[0])%v.size[1]; c[2] = i/(v.size[0]*v.size[1]);
+		bool seed = (v.dist[i] == 0);
+
+		for(o[2]=(v.ndim == 3) ? -1 : 0;o[2]<=((v.ndim == 3) ? 1 : 0);o[2]++)
+			for(o[1]=-1;o[1]<=1;o[1]++)
+				for(o[0]=-1;o[0]<=1;o[0]++)
+				{
+					int nz = (o[0] != 0)+(o[1] != 0)+(o[2] != 0);
+					if((nz == 0)||(((method == METHOD_CITYBLOCK)||((method == METHOD_FMM)&&!seed))&&(nz > 1))) continue;
+					long long cn[3];
+					for(d=0;d<3;d++) cn[d] = c[d]+o[d];
+					if((cn[0] < 0)||(cn[0] >= v.size[0])||(cn[1] < 0)||(cn[1] >= v.size[1])||(cn[2] < 0)||(cn[2] >= v.size[2])) continue;
+					j = cn[0]+cn[1]*v.stride[1]+cn[2]*v.stride[2];
+					if(v.state[j] != STATE_FAR) continue;
+
+					double t;
+					unsigned int lab = v.label[i];
+					if((method == METHOD_FMM)&&!seed) t = fmm_update(v, j, cn, &lab);
+					else
+					{
+						double len = 0, l;
+						for(d=0;d<v.ndim;d++)
+						{
+							l = fabs(o[d]*v.spacing[d]);
+							if(method == METHOD_CHESSBOARD) len = (l > len) ? l : len;
+							else if((method == METHOD_QUASI_EUCLIDEAN)||(method == METHOD_FMM)) len += l*l;
+							else len += l;
+						}
+						if((method == METHOD_QUASI_EUCLIDEAN)||(method == METHOD_FMM)) len = sqrt(len);
+						t = v.dist[i]+len*((v.speed == NULL) ? 1.0 : 0.5*(slowness(v, i)+slowness(v, j)));
+					}
+					if(t < v.dist[j])
+					{
+						v.dist[j] = t;
+						v.label[j] = lab;
+						band.push(BandEntry(t, j));
+					}
+				}
+	}
+}
+
+// Seed label at voxel i, 0 if not a seed
+static unsigned int seed_label(const mxArray *seeds, long long i, unsigned int *rank)
+{
+	switch(mxGetClassID(seeds))
+	{
+		case mxLOGICAL_CLASS: return ((const mxLogical *)mxGetData(seeds))[i] ? ++(*rank) : 0;
+		case mxUINT8_CLASS: return ((const unsigned char *)mxGetData(seeds))[i];
+		case mxUINT16_CLASS: return ((const unsigned short *)mxGetData(seeds))[i];
+		case mxUINT32_CLASS: return ((const unsigned int *)mxGetData(seeds))[i];
+		case mxSINGLE_CLASS: return (unsigned int)((const float *)mxGetData(seeds))[i];
+		default: return (unsigned int)mxGetPr(seeds)[i];
+	}
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	GeodesicVolume v;
+	NarrowBand band;
+	const mxArray *seeds;
+	const mxLogical *mask = NULL;
+	char name[32] = "fmm";
+	int d, method;
+	long long i;
+	unsigned int rank = 0, lab;
+
+	if((nrhs < 2)||(nrhs > 5)) mexErrMsgTxt("Two to five inputs are required.");
+	if(nlhs > 2) mexErrMsgTxt("At most two outputs.");
+
+	// Seeds, size of the image
+	seeds = prhs[1];
+	switch(mxGetClassID(seeds))
+	{
+		case mxLOGICAL_CLASS: case mxUINT8_CLASS: case mxUINT16_CLASS: case mxUINT32_CLASS: case mxSINGLE_CLASS: case mxDOUBLE_CLASS: break;
+		default: mexErrMsgTxt("Seeds must be logical, uint8, uint16, uint32, single or double.");
+	}
+	v.ndim = (int)mxGetNumberOfDimensions(seeds);
+	if(v.ndim > 3) mexErrMsgTxt("Seeds must be 2D or 3D.");
+	for(d=0;d<3;d++) v.size[d] = (d < v.ndim) ? (long long)mxGetDimensions(seeds)[d] : 1;
+	v.stride[0] = 1; v.stride[1] = v.size[0]; v.stride[2] = v.size[0]*v.size[1];
+	v.n = v.size[0]*v.size[1]*v.size[2];
+
+	// Domain
+	if(!mxIsEmpty(prhs[0]))
+	{
+		if(!mxIsLogical(prhs[0])||((long long)mxGetNumberOfElements(prhs[0]) != v.n)) mexErrMsgTxt("Mask must be logical, with the size of Seeds.");
+		mask = mxGetLogicals(prhs[0]);
+	}
+	v.speed = NULL;
+	v.single = false;
+	if((nrhs > 2)&&!mxIsEmpty(prhs[2]))
+	{
+		if((!mxIsDouble(prhs[2])&&!mxIsSingle(prhs[2]))||((long long)mxGetNumberOfElements(prhs[2]) != v.n)) mexErrMsgTxt("Speed must be single or double, with the size of Seeds.");
+		v.speed = mxGetData(prhs[2]);
+		v.single = mxIsSingle(prhs[2]);
+	}
+	for(d=0;d<3;d++) v.spacing[d] = 1;
+	if((nrhs > 3)&&!mxIsEmpty(prhs[3]))
+	{
+		if(!mxIsDouble(prhs[3])||((int)mxGetNumberOfElements(prhs[3]) < v.ndim)) mexErrMsgTxt("Spacing must be double, one value per dimension.");
+		for(d=0;d<v.ndim;d++) v.spacing[d] = mxGetPr(prhs[3])[d];
+		for(d=0;d<v.ndim;d++) if(!(v.spacing[d] > 0)) mexErrMsgTxt("Spacing must be positive.");
+	}
+	if(nrhs > 4)
+	{
+		if(!mxIsChar(prhs[4])) mexErrMsgTxt("Method must be a string.");
+		mxGetString(prhs[4], name, sizeof(name));
+	}
+	if(!strcmp(name, "fmm")) method = METHOD_FMM;
+	else if(!strcmp(name, "quasi-euclidean")) method = METHOD_QUASI_EUCLIDEAN;
+	else if(!strcmp(name, "chessboard")) method = METHOD_CHESSBOARD;
+	else if(!strcmp(name, "cityblock")) method = METHOD_CITYBLOCK;
+	else mexErrMsgTxt("Method must be 'fmm', 'quasi-euclidean', 'chessboard' or 'cityblock'.");
+
+	// Initial narrow band: the seeds
+	v.state.assign(v.n, STATE_FAR);
+	v.dist.assign(v.n, HUGE_VAL);
+	v.label.assign(v.n, 0);
+	for(i=0;i<v.n;i++)
+	{
+		if((mask != NULL)&&!mask[i]) v.state[i] = STATE_OUTSIDE;
+		else if(!((slowness(v, i) >= 0)&&(slowness(v, i) < HUGE_VAL))) v.state[i] = STATE_OUTSIDE;
+		lab = seed_label(seeds, i, &rank);
+		if((lab == 0)||(v.state[i] == STATE_OUTSIDE)) continue;
+		v.dist[i] = 0;
+		v.label[i] = lab;
+		band.push(BandEntry(0.0, i));
+	}
+
+	grow(v, band, method);
+
+	// Outputs
+	mwSize dims[3] = {(mwSize)v.size[0], (mwSize)v.size[1], (mwSize)v.size[2]};
+	plhs[0] = mxCreateNumericArray(v.ndim, dims, mxSINGLE_CLASS, mxREAL);
+	float *D = (float *)mxGetData(plhs[0]);
+	for(i=0;i<v.n;i++) D[i] = (v.state[i] == STATE_OUTSIDE) ? (float)mxGetNaN() : (float)v.dist[i];
+	if(nlhs > 1)
+	{
+		plhs[1] = mxCreateNumericArray(v.ndim, dims, mxUINT32_CLASS, mxREAL);
+		memcpy(mxGetData(plhs[1]), &v.label[0], v.n*sizeof(unsigned int));
+	}
+}
@@ -0,0 +1,381 @@
+#include <math.h>
+#include "matrix.h"
+#include "mex.h"
+#include <vector>
+#include <omp.h>
+
+#include "rk4_functions.c"
+
+// [ShortestLines, DistancetoEnd] = rk4paths(DistanceMap, StartPoints, SourcePoints, Stepsize)
+// [ShortestLines, DistancetoEnd] = rk4paths(GradientVolume, StartPoints, SourcePoints, Stepsize)
+//
+// Native batch version of the 'rk4' loop of shortestpath.m: the paths of all the start points
+// (columns of StartPoints, 2 x N or 3 x N, 1-based) are traced in parallel with the RK4 step of
+// rk4.c. The gradient is either read from GradientVolume (double, size [size(DistanceMap) 2] or
+// [size(DistanceMap) 3], as built by shortestpath.m), or computed on the fly from DistanceMap
+// (single or double, 2D or 3D) at the voxels sampled by the steps, with the same values as
+// pointmin.m: no gradient volume is allocated.
+// A path stops when it leaves the volume, when it moved less than Stepsize in the last 10 steps,
+// or when it comes closer than Stepsize to a source point (the source point is then appended).
+// SourcePoints (optional): 2 x M or 3 x M source points, [] for none
+// Stepsize (optional): default 0.5
+// ShortestLines: 1 x N cell array of the K x 2 or K x 3 paths (same output as shortestpath)
+// DistancetoEnd: 1 x N distance of the last traced point to the closest source point (Inf if none)
+// A path also stops if the step becomes undefined (zero gradient, the MATLAB loop never ends).
+
+// Source points bucketed in a regular grid of cells of size Stepsize: the source points closer
+// than Stepsize to a point are in the 3x3(x3) cells around it
+struct SourceGrid
+{
+	int ndim;
+	const double *points;
+	long long npoints;
+	double cell, lo[3];
+	long long size[3];
+	std::vector<long long> first, index;
+};
+
+static void build_grid(SourceGrid &g, const double *points, long long npoints, int ndim, double cell)
+{
+	double hi[3];
+	long long ncells = 1, c, k;
+	int d;
+
+	g.ndim = ndim; g.points = points; g.npoints = npoints;
+	for(d=0;d<ndim;d++)
+	{
+		g.lo[d] = hi[d] = points[d];
+		for(k=1;k<npoints;k++)
+		{
+			if(points[k*ndim+d] < g.lo[d]) g.lo[d] = points[k*ndim+d];
+			if(points[k*ndim+d] > hi[d]) hi[d] = points[k*ndim+d];
+		}
+	}
+	// Cap the number of cells to the number of source points (sparse sources)
+	g.cell = cell;
+	for(;;)
+	{
+		ncells = 1;
+		for(d=0;d<ndim;d++)
+		{
+			g.size[d] = (long long)floor((hi[d]-g.lo[d])/g.cell)+1;
+			ncells *= g.size[d];
+		}
+		if(ncells <= 4*npoints+64) break;
+		g.cell *= 2;
+	}
+	for(d=ndim;d<3;d++) { g.lo[d] = 0; g.size[d] = 1; }
+
+	// Counting sort of the source points by cell, increasing index in each cell
+	g.first.assign(ncells+1, 0);
+	g.index.resize(npoints);
+	std::vector<long long> cellof(npoints);
+	for(k=0;k<npoints;k++)
+	{
+		c = 0;
+		for(d=ndim-1;d>=0;d--) c = c*g.size[d] + (long long)floor((points[k*ndim+d]-g.lo[d])/g.cell);
+		cellof[k] = c;
+		g.first[c+1]++;
+	}
+	for(c=0;c<ncells;c++) g.first[c+1] += g.first[c];
+	std::vector<long long> fill(g.first.begin(), g.first.end()-1);
+	for(k=0;k<npoints;k++) g.index[fill[cellof[k]]++] = k;
+}
+
+static double source_distance(const SourceGrid &g, const double *p, long long k)
+{
+	double s = 0, t;
+	for(int d=0;d<g.ndim;d++) { t = g.points[k*g.ndim+d]-p[d]; s += t*t; }
+	return sqrt(s);
+}
+
+// Closest source point (lowest index on ties) strictly closer than radius (<= cell), -1 if none
+static long long closest_source(const SourceGrid &g, const double *p, double radius, double *dist)
+{
+	long long c[3], lo[3], hi[3], x, y, z, j, k, best = -1;
+	double dk;
+	int d;
+
+	for(d=0;d<3;d++)
+	{
+		c[d] = (d < g.ndim) ? (long long)floor((p[d]-g.lo[d])/g.cell) : 0;
+		lo[d] = (c[d]-1 < 0) ? 0 : c[d]-1;
+		hi[d] = (c[d]+1 > g.size[d]-1) ? g.size[d]-1 : c[d]+1;
+		if(lo[d] > hi[d]) return -1;
+	}
+	*dist = radius;
+	for(z=lo[2];z<=hi[2];z++)
+		for(y=lo[1];y<=hi[1];y++)
+			for(x=lo[0];x<=hi[0];x++)
+				for(j=g.first[x+g.size[0]*(y+g.size[1]*z)];j<g.first[x+g.size[0]*(y+g.size[1]*z)+1];j++)
+				{
+					k = g.index[j];
+					dk = source_distance(g, p, k);
+					if((dk < *dist)||((dk == *dist)&&(best >= 0)&&(k < best))) { *dist = dk; best = k; }
+				}
+	return best;
+}
+
+// Gradient of pointmin.m computed on the fly from the distance map: minus the unit offset to the
+// lowest of the 8 (26) neighbours strictly lower than the voxel (first one in the order of
+// pointmin.m on ties), 0 if none. The gradients of the last voxels sampled are kept in a small
+// direct mapped cache, one per path (the 4 RK4 sub-steps sample the same voxels).
+#define GRADIENT_CACHE 64
+
+struct DistanceField
+{
+	const void *map;
+	bool single;
+	int ndim;
+	long long key[GRADIENT_CACHE];
+	double grad[GRADIENT_CACHE][3];
+};
+
+template <typename T>
+static void pointmin_gradient(const T *D, int *Isize, int ndim, int x, int y, int z, double *g)
+{
+	long long sx = Isize[0], sxy = (long long)Isize[0]*Isize[1];
+	T cur = D[x+y*sx+z*sxy], v;
+	int a, b, c, zlo = (ndim == 3) ? -1 : 0, zhi = (ndim == 3) ? 1 : 0;
+	double nrm;
+
+	g[0] = g[1] = g[2] = 0;
+	for(a=-1;a<=1;a++)
+		for(b=-1;b<=1;b++)
+			for(c=zlo;c<=zhi;c++)
+			{
+				if((a == 0)&&(b == 0)&&(c == 0)) continue;
+				if((x+a < 0)||(x+a >= Isize[0])||(y+b < 0)||(y+b >= Isize[1])||(z+c < 0)||(z+c >= ((ndim == 3) ? Isize[2] : 1))) continue;
+				v = D[(x+a)+(y+b)*sx+(z+c)*sxy];
+				if(v < cur)
+				{
+					cur = v;
+					nrm = sqrt((double)(a*a+b*b+c*c));
+					g[0] = -(a/nrm); g[1] = -(b/nrm); g[2] = -(c/nrm);
+				}
+			}
+}
+
+static void voxel_gradient(DistanceField *f, int *Isize, int x, int y, int z, double *g)
+{
+	long long i = x+(long long)Isize[0]*(y+(long long)Isize[1]*z);
+	int slot = (int)(((unsigned long long)i*0x9E3779B97F4A7C15ULL) >> 58);
+
+	if(f->key[slot] != i)
+	{
+		if(f->single) pointmin_gradient((const float *)f->map, Isize, f->ndim, x, y, z, f->grad[slot]);
+		else pointmin_gradient((const double *)f->map, Isize, f->ndim, x, y, z, f->grad[slot]);
+		f->key[slot] = i;
+	}
+	g[0] = f->grad[slot][0]; g[1] = f->grad[slot][1]; g[2] = f->grad[slot][2];
+}
+
+// Same interpolation as interpgrad2d / interpgrad3d, the corner gradients from voxel_gradient
+static void interpmin2d(double *Ireturn, void *field, int *Isize, double *point)
+{
+	DistanceField *f = (DistanceField *)field;
+	int xBas0, xBas1, yBas0, yBas1;
+	double perc[4];
+	double xCom, yCom, xComi, yComi;
+	double fTlocalx, fTlocaly;
+	double g[4][3];
+
+	fTlocalx = floor(point[0]); fTlocaly = floor(point[1]);
+	xBas0=(int) fTlocalx; yBas0=(int) fTlocaly;
+	xBas1=xBas0+1; yBas1=yBas0+1;
+
+	xCom=point[0]-fTlocalx; yCom=point[1]-fTlocaly;
+	xComi=(1-xCom); yComi=(1-yCom);
+	perc[0]=xComi * yComi;
+	perc[1]=xComi * yCom;
+	perc[2]=xCom * yComi;
+	perc[3]=xCom * yCom;
+
+	if(xBas0<0) { xBas0=0; if(xBas1<0) { xBas1=0; }}
+	if(yBas0<0) { yBas0=0; if(yBas1<0) { yBas1=0; }}
+	if(xBas1>(Isize[0]-1)) { xBas1=Isize[0]-1; if(xBas0>(Isize[0]-1)) { xBas0=Isize[0]-1; }}
+	if(yBas1>(Isize[1]-1)) { yBas1=Isize[1]-1; if(yBas0>(Isize[1]-1)) { yBas0=Isize[1]-1; }}
+
+	voxel_gradient(f, Isize, xBas0, yBas0, 0, g[0]);
+	voxel_gradient(f, Isize, xBas0, yBas1, 0, g[1]);
+	voxel_gradient(f, Isize, xBas1, yBas0, 0, g[2]);
+	voxel_gradient(f, Isize, xBas1, yBas1, 0, g[3]);
+
+	Ireturn[0]=g[0][0]*perc[0]+g[1][0]*perc[1]+g[2][0]*perc[2]+g[3][0]*perc[3];
+	Ireturn[1]=g[0][1]*perc[0]+g[1][1]*perc[1]+g[2][1]*perc[2]+g[3][1]*perc[3];
+}
+
+static void interpmin3d(double *Ireturn, void *field, int *Isize, double *point)
+{
+	DistanceField *f = (DistanceField *)field;
+	int xBas0, xBas1, yBas0, yBas1, zBas0, zBas1;
+	double perc[8];
+	double xCom, yCom, zCom;
+	double xComi, yComi, zComi;
+	double fTlocalx, fTlocaly, fTlocalz;
+	double temp;
+	double g[8][3];
+	int d;
+
+	fTlocalx = floor(point[0]); fTlocaly = floor(point[1]); fTlocalz = floor(point[2]);
+	xBas0=(int) fTlocalx; yBas0=(int) fTlocaly; zBas0=(int) fTlocalz;
+	xBas1=xBas0+1; yBas1=yBas0+1; zBas1=zBas0+1;
+
+	xCom=point[0]-fTlocalx;  yCom=point[1]-fTlocaly;   zCom=point[2]-fTlocalz;
+	xComi=(1-xCom); yComi=(1-yCom); zComi=(1-zCom);
+	perc[0]=xComi * yComi; perc[1]=perc[0] * zCom; perc[0]=perc[0] * zComi;
+	perc[2]=xComi * yCom;  perc[3]=perc[2] * zCom; perc[2]=perc[2] * zComi;
+	perc[4]=xCom * yComi;  perc[5]=perc[4] * zCom; perc[4]=perc[4] * zComi;
+	perc[6]=xCom * yCom;   perc[7]=perc[6] * zCom; perc[6]=perc[6] * zComi;
+
+	if(xBas0<0) { xBas0=0; if(xBas1<0) { xBas1=0; }}
+	if(yBas0<0) { yBas0=0; if(yBas1<0) { yBas1=0; }}
+	if(zBas0<0) { zBas0=0; if(zBas1<0) { zBas1=0; }}
+	if(xBas1>(Isize[0]-1)) { xBas1=Isize[0]-1; if(xBas0>(Isize[0]-1)) { xBas0=Isize[0]-1; }}
+	if(yBas1>(Isize[1]-1)) { yBas1=Isize[1]-1; if(yBas0>(Isize[1]-1)) { yBas0=Isize[1]-1; }}
+	if(zBas1>(Isize[2]-1)) { zBas1=Isize[2]-1; if(zBas0>(Isize[2]-1)) { zBas0=Isize[2]-1; }}
+
+	voxel_gradient(f, Isize, xBas0, yBas0, zBas0, g[0]);
+	voxel_gradient(f, Isize, xBas0, yBas0, zBas1, g[1]);
+	voxel_gradient(f, Isize, xBas0, yBas1, zBas0, g[2]);
+	voxel_gradient(f, Isize, xBas0, yBas1, zBas1, g[3]);
+	voxel_gradient(f, Isize, xBas1, yBas0, zBas0, g[4]);
+	voxel_gradient(f, Isize, xBas1, yBas0, zBas1, g[5]);
+	voxel_gradient(f, Isize, xBas1, yBas1, zBas0, g[6]);
+	voxel_gradient(f, Isize, xBas1, yBas1, zBas1, g[7]);
+
+	for(d=0;d<3;d++)
+	{
+		temp=g[0][d]*perc[0]+g[1][d]*perc[1]+g[2][d]*perc[2]+g[3][d]*perc[3];
+		Ireturn[d]=temp+g[4][d]*perc[4]+g[5][d]*perc[5]+g[6][d]*perc[6]+g[7][d]*perc[7];
+	}
+}
+
+// Trace one path (same loop as shortestpath.m), returns the distance of the last point to the sources
+static double trace_path(double *grad, const void *map, bool single, int *isize, int ndim, const double *start,
+                         const SourceGrid *g, double step, std::vector<double> &line)
+{
+	double point[3], next[3], dist = HUGE_VAL, movement, t;
+	long long i = 0, ind, k;
+	bool inside;
+	int d;
+	DistanceField field;
+	InterpGradFunction interp;
+	void *data;
+
+	if(grad != NULL)
+	{
+		interp = (ndim == 2) ? interpgrad2d_field : interpgrad3d_field;
+		data = grad;
+	}
+	else
+	{
+		field.map = map;
+		field.single = single;
+		field.ndim = ndim;
+		for(d=0;d<GRADIENT_CACHE;d++) field.key[d] = -1;
+		interp = (ndim == 2) ? interpmin2d : interpmin3d;
+		data = &field;
+	}
+
+	for(d=0;d<ndim;d++) point[d] = start[d]-1.0;
+	for(;;)
+	{
+		if(ndim == 2) inside = RK4STEP_2D_FIELD(interp, data, isize, point, next, step);
+		else inside = RK4STEP_3D_FIELD(interp, data, isize, point, next, step);
+		for(d=0;d<ndim;d++) next[d] = inside ? next[d]+1.0 : 0;
+		for(d=0;d<ndim;d++) if(next[d] != next[d]) inside = false;
+
+		ind = -1;
+		if(g != NULL) ind = closest_source(*g, next, step, &dist);
+
+		if(i > 10)
+		{
+			movement = 0;
+			for(d=0;d<ndim;d++) { t = next[d]-line[(i-11)*ndim+d]; movement += t*t; }
+			movement = sqrt(movement);
+		}
+		else movement = step+1;
+
+		if((!inside)||(movement < step)) break;
+
+		i++;
+		for(d=0;d<ndim;d++) line.push_back(next[d]);
+
+		if(ind >= 0)
+		{
+			for(d=0;d<ndim;d++) line.push_back(g->points[ind*ndim+d]);
+			return dist;
+		}
+		for(d=0;d<ndim;d++) point[d] = next[d]-1.0;
+	}
+
+	// Exact distance of the last point to the sources
+	if(g == NULL) return HUGE_VAL;
+	dist = HUGE_VAL;
+	for(k=0;k<g->npoints;k++) { t = source_distance(*g, next, k); if(t < dist) dist = t; }
+	return dist;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if((nrhs < 2)||(nrhs > 4)) mexErrMsgTxt("Two to four inputs are required.");
+	if(!mxIsDouble(prhs[1])) mexErrMsgTxt("StartPoints must be of class double.");
+
+	const mwSize *dims = mxGetDimensions(prhs[0]);
+	int ndim = (int)mxGetM(prhs[1]);
+	if((ndim != 2)&&(ndim != 3)) mexErrMsgTxt("Start points must be 2D or 3D (columns).");
+	int isize[3] = {(int)dims[0], (int)dims[1], (ndim == 3) ? (int)dims[2] : 1};
+	double *grad = NULL;
+	const void *map = NULL;
+	bool single = false;
+	if((int)mxGetNumberOfDimensions(prhs[0]) == ndim+1)
+	{
+		if(!mxIsDouble(prhs[0])||((int)dims[ndim] != ndim)) mexErrMsgTxt("GradientVolume must be double, with one channel per dimension.");
+		grad = mxGetPr(prhs[0]);
+	}
+	else if((int)mxGetNumberOfDimensions(prhs[0]) == ndim)
+	{
+		if(!mxIsDouble(prhs[0])&&!mxIsSingle(prhs[0])) mexErrMsgTxt("DistanceMap must be single or double.");
+		map = mxGetData(prhs[0]);
+		single = mxIsSingle(prhs[0]);
+	}
+	else mexErrMsgTxt("The first input does not match the start points dimension.");
+	const double *starts = mxGetPr(prhs[1]);
+	long long nstarts = (long long)mxGetN(prhs[1]);
+
+	double step = 0.5;
+	if((nrhs > 3)&&!mxIsEmpty(prhs[3])) step = mxGetScalar(prhs[3]);
+	SourceGrid grid, *g = NULL;
+	if((nrhs > 2)&&!mxIsEmpty(prhs[2]))
+	{
+		if(!mxIsDouble(prhs[2])||((int)mxGetM(prhs[2]) != ndim)) mexErrMsgTxt("SourcePoints must be double, one point per column.");
+		build_grid(grid, mxGetPr(prhs[2]), (long long)mxGetN(prhs[2]), ndim, (step > 0) ? step : 1);
+		g = &grid;
+	}
+
+	std::vector< std::vector<double> > lines(nstarts);
+	std::vector<double> dists(nstarts);
+
+	// Main loop, MATLAB API only outside of the threads
+	#pragma omp parallel for schedule(dynamic)
+	for(long long i=0;i<nstarts;i++)
+		dists[i] = trace_path(grad, map, single, isize, ndim, starts+i*ndim, g, step, lines[i]);
+
+	plhs[0] = mxCreateCellMatrix(1, (mwSize)nstarts);
+	for(long long i=0;i<nstarts;i++)
+	{
+		long long npts = (long long)lines[i].size()/ndim;
+		mxArray *a = mxCreateDoubleMatrix((mwSize)npts, ndim, mxREAL);
+		double *pr = mxGetPr(a);
+		for(long long k=0;k<npts;k++)
+			for(int d=0;d<ndim;d++) pr[k+d*npts] = lines[i][k*ndim+d];
+		mxSetCell(plhs[0], (mwIndex)i, a);
+	}
+	if(nlhs > 1)
+	{
+		plhs[1] = mxCreateDoubleMatrix(1, (mwSize)nstarts, mxREAL);
+		double *pr = mxGetPr(plhs[1]);
+		for(long long i=0;i<nstarts;i++) pr[i] = dists[i];
+	}
+}
@@ -31,6 +31,12 @@ if nargin<5
     whiteondark = true; % default
 end
 
+% fused native filter (compile jermanfilter3D.c), streamed along z
+if exist('jermanfilter3D','file') == 3 && ndims(I) == 3 && any(strcmp(class(I),{'double','single','uint8','uint16'}))
+    blobness = jermanfilter3D(I, double(sigmas), double(spacing), tau, whiteondark, 1);
+    return;
+end
+
 I(~isfinite(I)) = 0;
 I = single(I);
 
@@ -103,28 +109,34 @@ T(B1 .* B2 <= B3) = 0;
 
 clear B1 B2 B3;
 
-indeces = find(T==1);
+if exist('eig3masked','file') == 3
+    % Calculate eigen values in place, no gather/scatter copies
+    [Lambda1,Lambda2,Lambda3]=eig3masked(T==1,Hxx,Hxy,Hxz,Hyy,Hyz,Hzz,1);
+    clear Hxx Hyy Hzz Hxy Hxz Hyz;
+else
+    indeces = find(T==1);
 
-Hxx = Hxx(indeces);
-Hyy = Hyy(indeces);
-Hzz = Hzz(indeces);
-Hxz = Hxz(indeces);
-Hyz = Hyz(indeces);
-Hxy = Hxy(indeces);
+    Hxx = Hxx(indeces);
+    Hyy = Hyy(indeces);
+    Hzz = Hzz(indeces);
+    Hxz = Hxz(indeces);
+    Hyz = Hyz(indeces);
+    Hxy = Hxy(indeces);
 
-% Calculate eigen values
-[Lambda1i,Lambda2i,Lambda3i]=eig3volume(Hxx,Hxy,Hxz,Hyy,Hyz,Hzz);
+    % Calculate eigen values (6 inputs: also accepted by the bundled binary)
+    [Lambda1i,Lambda2i,Lambda3i]=eig3volume(Hxx,Hxy,Hxz,Hyy,Hyz,Hzz);
 
-% Free memory
-clear Hxx Hyy Hzz Hxy Hxz Hyz;
+    % Free memory
+    clear Hxx Hyy Hzz Hxy Hxz Hyz;
 
-Lambda1 = zeros(size(T));
-Lambda2 = zeros(size(T));
-Lambda3 = zeros(size(T));
+    Lambda1 = zeros(size(T));
+    Lambda2 = zeros(size(T));
+    Lambda3 = zeros(size(T));
 
-Lambda1(indeces) = Lambda1i;
-Lambda2(indeces) = Lambda2i;
-Lambda3(indeces) = Lambda3i;
+    Lambda1(indeces) = Lambda1i;
+    Lambda2(indeces) = Lambda2i;
+    Lambda3(indeces) = Lambda3i;
+end
 
 % some noise removal
 Lambda1(~isfinite(Lambda1)) = 0;
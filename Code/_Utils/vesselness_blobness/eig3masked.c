@@ -0,0 +1,131 @@
+#include "mex.h"
+#include "math.h"
+#include "eigen3_functions.c"
+
+/* [Lambda1,Lambda2,Lambda3,Vx,Vy,Vz] = eig3masked(M,Dxx,Dxy,Dxz,Dyy,Dyz,Dzz,Mode)
+ * [Lambda1,Lambda2,Lambda3,Vx,Vy,Vz] = eig3masked(M,H,Mode)
+ * eig3volume restricted to the voxels selected by M, without gathering the
+ * Hessian components nor scattering the eigenvalues: M is a logical mask
+ * (size of the volume) or a list of linear indices (double, 1-based), the
+ * Hessian is given as six volumes or as one interleaved array H (size
+ * [6 size(volume)], channels Dxx, Dxy, Dxz, Dyy, Dyz, Dzz).
+ * The outputs have the size of the volume (0 outside M) and the class of
+ * the Hessian (double or single), same ordering as eig3volume.
+ * Mode (optional): 0: JAMA, 1: closed form (default)
+ * The voxels are processed in parallel (OpenMP). */
+
+/* Hessian component c (Dxx, Dxy, Dxz, Dyy, Dyz, Dzz) at voxel i */
+static __inline double hessian(const void * const *h, mwSize stride, int single, int c, mwSize i) {
+    if (single) { return (double)((const float *)h[c])[i*stride]; }
+    return ((const double *)h[c])[i*stride];
+}
+
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
+    const void *h[6];
+    const mxArray *ref;
+    const mxLogical *mask = NULL;
+    const double *list = NULL;
+    void *out[6];
+    mwSize ndims, dims[8], stride, npixels, nlist;
+    mwSignedIndex j;
+    int interleaved, single, mode = 1, k;
+    mxClassID cls;
+
+    /* Check for proper number of arguments. */
+    if((nrhs<2)||(nrhs>8)||((nrhs>3)&&(nrhs<7))) {
+        mexErrMsgTxt("Inputs: M, six Hessian volumes or one interleaved Hessian, optional Mode.");
+    } else if((nlhs!=3)&&(nlhs!=6)) {
+        mexErrMsgTxt("Three or Six outputs are required");
+    }
+    interleaved = (nrhs<7);
+    if((interleaved&&(nrhs==3))||(!interleaved&&(nrhs==8))) { mode = (int)mxGetScalar(prhs[nrhs-1]); }
+    if((mode!=0)&&(mode!=1)) {
+        mexErrMsgTxt("Mode must be 0 or 1.");
+    }
+
+    /* Hessian */
+    ref = prhs[1];
+    cls = mxGetClassID(ref);
+    if((cls!=mxDOUBLE_CLASS)&&(cls!=mxSINGLE_CLASS)) {
+        mexErrMsgTxt("The Hessian must be double or single.");
+    }
+    single = (cls==mxSINGLE_CLASS);
+    if(interleaved) {
+        ndims = mxGetNumberOfDimensions(ref);
+        if((mxGetDimensions(ref)[0]!=6)||(ndims>8)) {
+            mexErrMsgTxt("The interleaved Hessian must have 6 channels along its first dimension.");
+        }
+        for(k=1; k<(int)ndims; k++) { dims[k-1] = mxGetDimensions(ref)[k]; }
+        ndims--;
+        if(ndims<2) { dims[ndims++] = 1; }
+        stride = 6;
+        for(k=0; k<6; k++) { h[k] = single ? (const void *)((const float *)mxGetData(ref) + k) : (const void *)((const double *)mxGetData(ref) + k); }
+    } else {
+        ndims = mxGetNumberOfDimensions(ref);
+        if(ndims>8) {
+            mexErrMsgTxt("Too many dimensions.");
+        }
+        for(k=0; k<(int)ndims; k++) { dims[k] = mxGetDimensions(ref)[k]; }
+        stride = 1;
+        for(k=0; k<6; k++) {
+            if((mxGetClassID(prhs[k+1])!=cls)||(mxGetNumberOfElements(prhs[k+1])!=mxGetNumberOfElements(ref))) {
+                mexErrMsgTxt("The six Hessian volumes must have the same class and number of elements.");
+            }
+            h[k] = mxGetData(prhs[k+1]);
+        }
+    }
+    npixels = 1;
+    for(k=0; k<(int)ndims; k++) { npixels *= dims[k]; }
+
+    /* Voxels */
+    if(mxIsLogical(prhs[0])) {
+        if(mxGetNumberOfElements(prhs[0])!=npixels) {
+            mexErrMsgTxt("The mask must have the size of the volume.");
+        }
+        mask = mxGetLogicals(prhs[0]);
+        nlist = npixels;
+    } else if(mxIsDouble(prhs[0])) {
+        list = mxGetPr(prhs[0]);
+        nlist = mxGetNumberOfElements(prhs[0]);
+        for(j=0; j<(mwSignedIndex)nlist; j++) {
+            if((list[j]<1)||(list[j]>npixels)||(list[j]!=floor(list[j]))) {
+                mexErrMsgTxt("Index out of range.");
+            }
+        }
+    } else {
+        mexErrMsgTxt("M must be a logical mask or a list of linear indices (double).");
+    }
+
+    /* Outputs, zero outside of the voxels */
+    for(k=0; k<nlhs; k++) {
+        plhs[k] = mxCreateNumericArray(ndims, dims, cls, mxREAL);
+        out[k] = mxGetData(plhs[k]);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for(j=0; j<(mwSignedIndex)nlist; j++) {
+        double Ma[3][3], Davec[3][3], Daeig[3], a, b, c, d, e, f, *vec;
+        mwSize i;
+        int m;
+        if(mask!=NULL) {
+            if(!mask[j]) { continue; }
+            i = (mwSize)j;
+        } else {
+            i = (mwSize)list[j] - 1;
+        }
+        a = hessian(h, stride, single, 0, i); b = hessian(h, stride, single, 1, i); c = hessian(h, stride, single, 2, i);
+        d = hessian(h, stride, single, 3, i); e = hessian(h, stride, single, 4, i); f = hessian(h, stride, single, 5, i);
+        vec = (nlhs==6) ? Davec[0] : NULL;
+        if((mode==0)||eigen_closed_form(a, b, c, d, e, f, Daeig, vec)) {
+            Ma[0][0]=a; Ma[0][1]=b; Ma[0][2]=c;
+            Ma[1][0]=b; Ma[1][1]=d; Ma[1][2]=e;
+            Ma[2][0]=c; Ma[2][1]=e; Ma[2][2]=f;
+            eigen_decomposition(Ma, Davec, Daeig);
+            Davec[0][1]=Davec[1][0]; Davec[0][2]=Davec[2][0];
+        }
+        for(m=0; m<nlhs; m++) {
+            double v = (m<3) ? Daeig[m] : Davec[0][m-3];
+            if(single) { ((float *)out[m])[i] = (float)v; } else { ((double *)out[m])[i] = v; }
+        }
+    }
+}
@@ -0,0 +1,328 @@
+/* Eigen decomposition of symmetric 3x3 matrices (JAMA and closed form),
+ * included by eig3volume.c and jermanfilter3D.c */
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a)>(b)?(a):(b))
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a)<(b)?(a):(b))
+#define n 3
+#define SQRT3 1.73205080756887729353
+/* Relative eigenvalue separation below which the closed form vector is not trusted */
+#define EIG_GAP_TOL 1e-6
+/* Distance of the cubic to a double root below which the closed form is not trusted */
+#define EIG_ROOT_TOL 1e-5
+
+/* This function
+ *
+ *
+ *
+ */
+
+/* Eigen decomposition code for symmetric 3x3 matrices, copied from the public
+ * domain Java Matrix library JAMA. */
+static double hypot2(double x, double y) { return sqrt(x*x+y*y); }
+
+__inline double absd(double val){ if(val>0){ return val;} else { return -val;} };
+
+/* Symmetric Householder reduction to tridiagonal form. */
+static void tred2(double V[n][n], double d[n], double e[n]) {
+    
+/*  This is derived from the Algol procedures tred2 by */
+/*  Bowdler, Martin, Reinsch, and Wilkinson, Handbook for */
+/*  Auto. Comp., Vol.ii-Linear Algebra, and the corresponding */
+/*  Fortran subroutine in EISPACK. */
+    int i, j, k;
+    double scale;
+    double f, g, h;
+    double hh;
+    for (j = 0; j < n; j++) {d[j] = V[n-1][j]; }
+    
+    /* Householder reduction to tridiagonal form. */
+    
+    for (i = n-1; i > 0; i--) {
+        /* Scale to avoid under/overflow. */
+        scale = 0.0;
+        h = 0.0;
+        for (k = 0; k < i; k++) { scale = scale + fabs(d[k]); }
+        if (scale == 0.0) {
+            e[i] = d[i-1];
+            for (j = 0; j < i; j++) { d[j] = V[i-1][j]; V[i][j] = 0.0;  V[j][i] = 0.0; }
+        } else {
+            
+            /* Generate Householder vector. */
+            
+            for (k = 0; k < i; k++) { d[k] /= scale; h += d[k] * d[k]; }
+            f = d[i-1];
+            g = sqrt(h);
+            if (f > 0) { g = -g; }
+            e[i] = scale * g;
+            h = h - f * g;
+            d[i-1] = f - g;
+            for (j = 0; j < i; j++) { e[j] = 0.0; }
+            
+            /* Apply similarity transformation to remaining columns. */
+            
+            for (j = 0; j < i; j++) {
+                f = d[j];
+                V[j][i] = f;
+                g = e[j] + V[j][j] * f;
+                for (k = j+1; k <= i-1; k++) { g += V[k][j] * d[k]; e[k] += V[k][j] * f; }
+                e[j] = g;
+            }
+            f = 0.0;
+            for (j = 0; j < i; j++) { e[j] /= h; f += e[j] * d[j]; }
+            hh = f / (h + h);
+            for (j = 0; j < i; j++) { e[j] -= hh * d[j]; }
+            for (j = 0; j < i; j++) {
+                f = d[j]; g = e[j];
+                for (k = j; k <= i-1; k++) { V[k][j] -= (f * e[k] + g * d[k]); }
+                d[j] = V[i-1][j];
+                V[i][j] = 0.0;
+            }
+        }
+        d[i] = h;
+    }
+    
+    /* Accumulate transformations. */
+    
+    for (i = 0; i < n-1; i++) {
+        V[n-1][i] = V[i][i];
+        V[i][i] = 1.0;
+        h = d[i+1];
+        if (h != 0.0) {
+            for (k = 0; k <= i; k++) { d[k] = V[k][i+1] / h;}
+            for (j = 0; j <= i; j++) {
+                g = 0.0;
+                for (k = 0; k <= i; k++) { g += V[k][i+1] * V[k][j]; }
+                for (k = 0; k <= i; k++) { V[k][j] -= g * d[k]; }
+            }
+        }
+        for (k = 0; k <= i; k++) { V[k][i+1] = 0.0;}
+    }
+    for (j = 0; j < n; j++) { d[j] = V[n-1][j]; V[n-1][j] = 0.0; }
+    V[n-1][n-1] = 1.0;
+    e[0] = 0.0;
+}
+
+/* Symmetric tridiagonal QL algorithm. */
+static void tql2(double V[n][n], double d[n], double e[n]) {
+    
+/*  This is derived from the Algol procedures tql2, by */
+/*  Bowdler, Martin, Reinsch, and Wilkinson, Handbook for */
+/*  Auto. Comp., Vol.ii-Linear Algebra, and the corresponding */
+/*  Fortran subroutine in EISPACK. */
+    
+    int i, j, k, l, m;
+    double f;
+    double tst1;
+    double eps;
+    int iter;
+    double g, p, r;
+    double dl1, h, c, c2, c3, el1, s, s2;
+    
+    for (i = 1; i < n; i++) { e[i-1] = e[i]; }
+    e[n-1] = 0.0;
+    
+    f = 0.0;
+    tst1 = 0.0;
+    eps = pow(2.0, -52.0);
+    for (l = 0; l < n; l++) {
+        
+        /* Find small subdiagonal element */
+        
+        tst1 = MAX(tst1, fabs(d[l]) + fabs(e[l]));
+        m = l;
+        while (m < n) {
+            if (fabs(e[m]) <= eps*tst1) { break; }
+            m++;
+        }
+        
+        /* If m == l, d[l] is an eigenvalue, */
+        /* otherwise, iterate. */
+        
+        if (m > l) {
+            iter = 0;
+            do {
+                iter = iter + 1;  /* (Could check iteration count here.) */
+                /* Compute implicit shift */
+                g = d[l];
+                p = (d[l+1] - g) / (2.0 * e[l]);
+                r = hypot2(p, 1.0);
+                if (p < 0) { r = -r; }
+                d[l] = e[l] / (p + r);
+                d[l+1] = e[l] * (p + r);
+                dl1 = d[l+1];
+                h = g - d[l];
+                for (i = l+2; i < n; i++) { d[i] -= h; }
+                f = f + h;
+                /* Implicit QL transformation. */
+                p = d[m]; c = 1.0; c2 = c; c3 = c;
+                el1 = e[l+1]; s = 0.0; s2 = 0.0;
+                for (i = m-1; i >= l; i--) {
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = hypot2(p, e[i]);
+                    e[i+1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i+1] = h + s * (c * g + s * d[i]);
+                    /* Accumulate transformation. */
+                    for (k = 0; k < n; k++) {
+                        h = V[k][i+1];
+                        V[k][i+1] = s * V[k][i] + c * h;
+                        V[k][i] = c * V[k][i] - s * h;
+                    }
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+                
+                /* Check for convergence. */
+            } while (fabs(e[l]) > eps*tst1);
+        }
+        d[l] = d[l] + f;
+        e[l] = 0.0;
+    }
+    
+    /* Sort eigenvalues and corresponding vectors. */
+    for (i = 0; i < n-1; i++) {
+        k = i;
+        p = d[i];
+        for (j = i+1; j < n; j++) {
+            if (d[j] < p) {
+                k = j;
+                p = d[j];
+            }
+        }
+        if (k != i) {
+            d[k] = d[i];
+            d[i] = p;
+            for (j = 0; j < n; j++) {
+                p = V[j][i];
+                V[j][i] = V[j][k];
+                V[j][k] = p;
+            }
+        }
+    }
+}
+
+void eigen_decomposition(double A[n][n], double V[n][n], double d[n]) {
+    double e[n];
+    double da[3];
+    double dt, dat;
+    double vet[3];
+    int i, j;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            V[i][j] = A[i][j];
+        }
+    }
+    tred2(V, d, e);
+    tql2(V, d, e);
+    
+    /* Sort the eigen values and vectors by abs eigen value */
+    da[0]=absd(d[0]); da[1]=absd(d[1]); da[2]=absd(d[2]);
+    if((da[0]>=da[1])&&(da[0]>da[2]))
+    {
+        dt=d[2];   dat=da[2];    vet[0]=V[0][2];    vet[1]=V[1][2];    vet[2]=V[2][2];
+        d[2]=d[0]; da[2]=da[0];  V[0][2] = V[0][0]; V[1][2] = V[1][0]; V[2][2] = V[2][0];
+        d[0]=dt;   da[0]=dat;    V[0][0] = vet[0];  V[1][0] = vet[1];  V[2][0] = vet[2]; 
+    }
+    else if((da[1]>=da[0])&&(da[1]>da[2]))  
+    {
+        dt=d[2];   dat=da[2];    vet[0]=V[0][2];    vet[1]=V[1][2];    vet[2]=V[2][2];
+        d[2]=d[1]; da[2]=da[1];  V[0][2] = V[0][1]; V[1][2] = V[1][1]; V[2][2] = V[2][1];
+        d[1]=dt;   da[1]=dat;    V[0][1] = vet[0];  V[1][1] = vet[1];  V[2][1] = vet[2]; 
+    }
+    if(da[0]>da[1])
+    {
+        dt=d[1];   dat=da[1];    vet[0]=V[0][1];    vet[1]=V[1][1];    vet[2]=V[2][1];
+        d[1]=d[0]; da[1]=da[0];  V[0][1] = V[0][0]; V[1][1] = V[1][0]; V[2][1] = V[2][0];
+        d[0]=dt;   da[0]=dat;    V[0][0] = vet[0];  V[1][0] = vet[1];  V[2][0] = vet[2]; 
+    }
+
+    
+}
+
+
+/* Closed form eigen decomposition of the symmetric matrix [a b c; b d e; c e f]
+ * (trigonometric solution of the characteristic cubic, O.K. Smith 1961).
+ * Same ordering as eigen_decomposition (increasing absolute value), v (if
+ * not NULL) receives the eigenvector of the smallest eigenvalue, up to sign.
+ * Returns 1 (the caller then falls back to eigen_decomposition) near a double
+ * root (|r| close to 1) or if the matrix is not finite, whether v is NULL or
+ * not, and if v is requested and the smallest eigenvalue is not well
+ * separated. Returns 0 otherwise. */
+static int eigen_closed_form(double a, double b, double c, double d, double e, double f, double l[n], double v[n]) {
+    double p1, p2, p, q, r, phi, t, gap, nrm, best;
+    double r0[3], r1[3], r2[3], cr[3][3];
+    int i, j, k, idx[3];
+    
+    p1 = b*b + c*c + e*e;
+    if (p1 == 0.0) {
+        /* Diagonal matrix, sorted as tql2 does */
+        l[0] = a; l[1] = d; l[2] = f; idx[0] = 0; idx[1] = 1; idx[2] = 2;
+        for (i = 0; i < n-1; i++) {
+            k = i;
+            for (j = i+1; j < n; j++) { if (l[j] < l[k]) { k = j; } }
+            if (k != i) { t = l[k]; l[k] = l[i]; l[i] = t; j = idx[k]; idx[k] = idx[i]; idx[i] = j; }
+        }
+    } else {
+        q = (a + d + f) / 3.0;
+        p2 = (a-q)*(a-q) + (d-q)*(d-q) + (f-q)*(f-q) + 2.0*p1;
+        p = sqrt(p2 / 6.0);
+        if (!(p > 0.0) || !(p < HUGE_VAL)) { return 1; }
+        r = ((a-q)*((d-q)*(f-q) - e*e) - b*(b*(f-q) - e*c) + c*(b*e - (d-q)*c)) / (2.0*p*p*p);
+        /* Near a double root acos loses half of the digits */
+        if (!(absd(r) < 1.0 - EIG_ROOT_TOL)) { return 1; }
+        phi = acos(r) / 3.0;
+        t = cos(phi);
+        l[2] = q + 2.0*p*t;
+        l[0] = q - p*(t + SQRT3*sqrt(1.0 - t*t));   /* q + 2p cos(phi + 2pi/3) */
+        l[1] = 3.0*q - l[0] - l[2];
+        idx[0] = idx[1] = idx[2] = -1;
+    }
+    
+    /* Sort by absolute value, same swaps as eigen_decomposition */
+    if ((absd(l[0]) >= absd(l[1])) && (absd(l[0]) > absd(l[2]))) {
+        t = l[2]; l[2] = l[0]; l[0] = t; k = idx[2]; idx[2] = idx[0]; idx[0] = k;
+    } else if ((absd(l[1]) >= absd(l[0])) && (absd(l[1]) > absd(l[2]))) {
+        t = l[2]; l[2] = l[1]; l[1] = t; k = idx[2]; idx[2] = idx[1]; idx[1] = k;
+    }
+    if (absd(l[0]) > absd(l[1])) {
+        t = l[1]; l[1] = l[0]; l[0] = t; k = idx[1]; idx[1] = idx[0]; idx[0] = k;
+    }
+    if (v == NULL) { return 0; }
+    if (idx[0] >= 0) {
+        v[0] = v[1] = v[2] = 0.0; v[idx[0]] = 1.0;
+        return 0;
+    }
+    
+    /* Eigenvector: largest cross product of two rows of A - l[0] I, the
+     * eigenvalue must be well separated from the two others */
+    gap = MIN(absd(l[1] - l[0]), absd(l[2] - l[0]));
+    if (!(gap > EIG_GAP_TOL * MAX(absd(l[1]), absd(l[2])))) { return 1; }
+    r0[0] = a - l[0]; r0[1] = b;        r0[2] = c;
+    r1[0] = b;        r1[1] = d - l[0]; r1[2] = e;
+    r2[0] = c;        r2[1] = e;        r2[2] = f - l[0];
+    cr[0][0] = r0[1]*r1[2] - r0[2]*r1[1]; cr[0][1] = r0[2]*r1[0] - r0[0]*r1[2]; cr[0][2] = r0[0]*r1[1] - r0[1]*r1[0];
+    cr[1][0] = r0[1]*r2[2] - r0[2]*r2[1]; cr[1][1] = r0[2]*r2[0] - r0[0]*r2[2]; cr[1][2] = r0[0]*r2[1] - r0[1]*r2[0];
+    cr[2][0] = r1[1]*r2[2] - r1[2]*r2[1]; cr[2][1] = r1[2]*r2[0] - r1[0]*r2[2]; cr[2][2] = r1[0]*r2[1] - r1[1]*r2[0];
+    best = 0.0; k = 0;
+    for (i = 0; i < 3; i++) {
+        nrm = cr[i][0]*cr[i][0] + cr[i][1]*cr[i][1] + cr[i][2]*cr[i][2];
+        if (nrm > best) { best = nrm; k = i; }
+    }
+    if (!(best > 0.0) || !(best < HUGE_VAL)) { return 1; }
+    nrm = 1.0 / sqrt(best);
+    v[0] = cr[k][0]*nrm; v[1] = cr[k][1]*nrm; v[2] = cr[k][2]*nrm;
+    return 0;
+}
+#undef n
@@ -0,0 +1,292 @@
+#include "mex.h"
+#include "math.h"
+#include <string.h>
+#include "eigen3_functions.c"
+
+/* R = jermanfilter3D(I,sigmas,spacing,tau,whiteondark,Type)
+ * Native vesselness3D (Type 0, default) or blobness3D (Type 1): same
+ * Gaussian smoothing, Hessian, pre-screening, eigenvalues (closed form) and
+ * Jerman response as the MATLAB code, maximum over the scales sigmas,
+ * normalized to 1. I can be double, single, uint8 or uint16, R is single.
+ * whiteondark (optional): bright structures on a dark background (default
+ * true).
+ *
+ * Nothing volume sized is allocated but R: the planes are streamed along z,
+ * only 3 smoothed planes and 3 planes of each first derivative are kept.
+ * The response threshold depends on min(Lambda3) over the whole volume, so
+ * every scale is swept twice (first sweep: min(Lambda3) only). */
+
+typedef struct {
+    const void *data;
+    mxClassID cls;
+    mwSignedIndex nx, ny, nz, nxy;
+    float *hx, *hy, *hz;
+    int rx, ry, rz;
+    float *F[3];            /* smoothed planes, z % 3 */
+    float *D[3][3];         /* Dx, Dy, Dz planes, z % 3 */
+    float *tmp, *tmp2;
+} JermanContext;
+
+static __inline mwSignedIndex clampi(mwSignedIndex v, mwSignedIndex hi) { return (v < 0) ? 0 : ((v > hi) ? hi : v); }
+
+static __inline float finite_or_zero(double v) { return ((v == v) && (v - v == 0.0)) ? (float)v : 0.0f; }
+
+/* Normalized 1D Gaussian kernel of imgaussian (size 6 sigma, in voxels of
+ * spacing sp), radius in *r */
+static float *gaussian_kernel(double sigma, double sp, int *r) {
+    float *h;
+    double *g, sum = 0.0;
+    int k;
+    *r = (int)ceil(sigma*6.0/sp/2.0);
+    g = (double *)mxMalloc((2*(*r)+1)*sizeof(double));
+    h = (float *)mxMalloc((2*(*r)+1)*sizeof(float));
+    for (k = -(*r); k <= *r; k++) { g[k+*r] = exp(-((double)k*k/(2.0*(sigma/sp)*(sigma/sp)))); sum += g[k+*r]; }
+    for (k = 0; k <= 2*(*r); k++) { h[k] = (float)(g[k]/sum); }
+    mxFree(g);
+    return h;
+}
+
+/* Row y of input plane z as float, non finite values set to 0 */
+static void input_row(const JermanContext *ctx, mwSignedIndex y, mwSignedIndex z, float *row) {
+    mwSignedIndex x, o = y*ctx->nx + z*ctx->nxy;
+    switch (ctx->cls) {
+        case mxDOUBLE_CLASS: for (x = 0; x < ctx->nx; x++) { row[x] = finite_or_zero(((const double *)ctx->data)[o+x]); } break;
+        case mxSINGLE_CLASS: for (x = 0; x < ctx->nx; x++) { row[x] = finite_or_zero(((const float *)ctx->data)[o+x]); } break;
+        case mxUINT16_CLASS: for (x = 0; x < ctx->nx; x++) { row[x] = (float)((const unsigned short *)ctx->data)[o+x]; } break;
+        default:             for (x = 0; x < ctx->nx; x++) { row[x] = (float)((const unsigned char *)ctx->data)[o+x]; } break;
+    }
+}
+
+/* Smoothed plane z (separable Gaussian, replicated borders: z, x then y) */
+static void smooth_plane(JermanContext *ctx, mwSignedIndex z, float *dst, int smooth) {
+    mwSignedIndex y;
+    #pragma omp parallel for schedule(dynamic)
+    for (y = 0; y < ctx->ny; y++) {
+        mwSignedIndex x, o = y*ctx->nx;
+        float *acc = ctx->tmp + o, *row = ctx->tmp2 + o;
+        int k;
+        if (!smooth) { input_row(ctx, y, z, dst + o); continue; }
+        for (x = 0; x < ctx->nx; x++) { acc[x] = 0.0f; }
+        for (k = -ctx->rz; k <= ctx->rz; k++) {
+            input_row(ctx, y, clampi(z+k, ctx->nz-1), row);
+            for (x = 0; x < ctx->nx; x++) { acc[x] += ctx->hz[k+ctx->rz]*row[x]; }
+        }
+        for (x = 0; x < ctx->nx; x++) {
+            float s = 0.0f;
+            for (k = -ctx->rx; k <= ctx->rx; k++) { s += ctx->hx[k+ctx->rx]*acc[clampi(x+k, ctx->nx-1)]; }
+            row[x] = s;
+        }
+    }
+    if (!smooth) { return; }
+    #pragma omp parallel for schedule(dynamic)
+    for (y = 0; y < ctx->ny; y++) {
+        mwSignedIndex x, o = y*ctx->nx;
+        const float *src;
+        int k;
+        for (x = 0; x < ctx->nx; x++) { dst[o+x] = 0.0f; }
+        for (k = -ctx->ry; k <= ctx->ry; k++) {
+            src = ctx->tmp2 + clampi(y+k, ctx->ny-1)*ctx->nx;
+            for (x = 0; x < ctx->nx; x++) { dst[o+x] += ctx->hy[k+ctx->ry]*src[x]; }
+        }
+    }
+}
+
+/* Derivative of gradient3 at position pos of len samples (lo/hi: previous
+ * and next sample, cur: the sample itself) */
+static __inline float grad3(float lo, float cur, float hi, mwSignedIndex pos, mwSignedIndex len) {
+    if (pos == 0) { return hi - cur; }
+    if (pos == len-1) { return cur - lo; }
+    return (hi - lo)/2;
+}
+
+#define GRADX(P, i, x)  grad3((x) > 0 ? (P)[(i)-1] : 0.0f, (P)[i], (x) < nx-1 ? (P)[(i)+1] : 0.0f, x, nx)
+#define GRADY(P, i, y)  grad3((y) > 0 ? (P)[(i)-nx] : 0.0f, (P)[i], (y) < ny-1 ? (P)[(i)+nx] : 0.0f, y, ny)
+
+/* First derivative planes of plane z */
+static void derivative_planes(JermanContext *ctx, mwSignedIndex z) {
+    const float *F = ctx->F[z%3], *Flo = ctx->F[(z+2)%3], *Fhi = ctx->F[(z+1)%3];
+    float *Dx = ctx->D[0][z%3], *Dy = ctx->D[1][z%3], *Dz = ctx->D[2][z%3];
+    mwSignedIndex nx = ctx->nx, ny = ctx->ny, nz = ctx->nz, y;
+    #pragma omp parallel for schedule(dynamic)
+    for (y = 0; y < ny; y++) {
+        mwSignedIndex x, i;
+        for (x = 0, i = y*nx; x < nx; x++, i++) {
+            Dx[i] = GRADX(F, i, x);
+            Dy[i] = GRADY(F, i, y);
+            Dz[i] = grad3(z > 0 ? Flo[i] : 0.0f, F[i], z < nz-1 ? Fhi[i] : 0.0f, z, nz);
+        }
+    }
+}
+
+/* Pre-screening of the voxels with an eigenvalue pattern that can respond
+ * (S.-F. Yang and C.-H. Cheng, Comput. Meth. Prog. Bio. 116(3), 2014) */
+static __inline int prescreen(float Hxx, float Hxy, float Hxz, float Hyy, float Hyz, float Hzz, int type) {
+    float B1, B2, B3;
+    B1 = -(Hxx + Hyy + Hzz);
+    B2 = Hxx*Hyy + Hxx*Hzz + Hyy*Hzz - Hxy*Hxy - Hxz*Hxz - Hyz*Hyz;
+    B3 = Hxx*Hyz*Hyz + Hxy*Hxy*Hzz + Hxz*Hyy*Hxz - Hxx*Hyy*Hzz - Hxy*Hyz*Hxz - Hxz*Hxy*Hyz;
+    if (B1 <= 0) { return 0; }
+    if (type == 0) {
+        if ((B2 <= 0) && (B3 == 0)) { return 0; }
+        if ((B2 > 0) && (B1*B2 < B3)) { return 0; }
+    } else {
+        if ((B2 <= 0) || (B3 <= 0) || (B1*B2 <= B3)) { return 0; }
+    }
+    return 1;
+}
+
+/* Sweep of the volume at one scale. pass 0: returns min(Lambda3),
+ * pass 1: keeps the maximum of R and the response (threshold tau*lmin) */
+static float sweep(JermanContext *ctx, double sigma, int whiteondark, int type, int pass, float lmin, double tau, float *R) {
+    mwSignedIndex nx = ctx->nx, ny = ctx->ny, nz = ctx->nz, nxy = ctx->nxy;
+    mwSignedIndex z, y, fnext = 0, dnext = 0;
+    float c = (float)(sigma*sigma), m = (float)(tau*lmin), *rowmin, result = 0.0f;
+    int smooth = (sigma > 0);
+
+    if (!whiteondark) { c = -c; }
+    rowmin = (float *)mxMalloc(ny*sizeof(float));
+    for (z = 0; z < nz; z++) {
+        const float *Dx, *Dy, *Dz, *Dxlo, *Dylo, *Dzlo, *Dxhi, *Dyhi, *Dzhi;
+        /* derivatives up to z+1, smoothed planes up to z+2 */
+        while (dnext <= MIN(z+1, nz-1)) {
+            while (fnext <= MIN(dnext+1, nz-1)) { smooth_plane(ctx, fnext, ctx->F[fnext%3], smooth); fnext++; }
+            derivative_planes(ctx, dnext);
+            dnext++;
+        }
+        Dx = ctx->D[0][z%3];      Dy = ctx->D[1][z%3];      Dz = ctx->D[2][z%3];
+        Dxlo = ctx->D[0][(z+2)%3]; Dylo = ctx->D[1][(z+2)%3]; Dzlo = ctx->D[2][(z+2)%3];
+        Dxhi = ctx->D[0][(z+1)%3]; Dyhi = ctx->D[1][(z+1)%3]; Dzhi = ctx->D[2][(z+1)%3];
+
+        #pragma omp parallel for schedule(dynamic)
+        for (y = 0; y < ny; y++) {
+            double Ma[3][3], Davec[3][3], l[3];
+            float Hxx, Hxy, Hxz, Hyy, Hyz, Hzz, L1, L2, L3, L3M, r, a2, d;
+            mwSignedIndex x, i;
+            int k;
+            rowmin[y] = 0.0f;
+            for (x = 0, i = y*nx; x < nx; x++, i++) {
+                Hxx = c*GRADX(Dx, i, x);
+                Hxy = c*GRADY(Dx, i, y);
+                Hxz = c*grad3(z > 0 ? Dxlo[i] : 0.0f, Dx[i], z < nz-1 ? Dxhi[i] : 0.0f, z, nz);
+                Hyy = c*GRADY(Dy, i, y);
+                Hyz = c*grad3(z > 0 ? Dylo[i] : 0.0f, Dy[i], z < nz-1 ? Dyhi[i] : 0.0f, z, nz);
+                Hzz = c*grad3(z > 0 ? Dzlo[i] : 0.0f, Dz[i], z < nz-1 ? Dzhi[i] : 0.0f, z, nz);
+                if (!prescreen(Hxx, Hxy, Hxz, Hyy, Hyz, Hzz, type)) { continue; }
+                if (eigen_closed_form(Hxx, Hxy, Hxz, Hyy, Hyz, Hzz, l, NULL)) {
+                    Ma[0][0]=Hxx; Ma[0][1]=Hxy; Ma[0][2]=Hxz;
+                    Ma[1][0]=Hxy; Ma[1][1]=Hyy; Ma[1][2]=Hyz;
+                    Ma[2][0]=Hxz; Ma[2][1]=Hyz; Ma[2][2]=Hzz;
+                    eigen_decomposition(Ma, Davec, l);
+                }
+                /* noise removal of volumeEigenvalues */
+                for (k = 0; k < 3; k++) {
+                    l[k] = finite_or_zero((float)l[k]);
+                    if (absd(l[k]) < 1e-4) { l[k] = 0; }
+                }
+                L1 = (float)l[0]; L2 = (float)l[1]; L3 = (float)l[2];
+                if (pass == 0) {
+                    if (L3 < rowmin[y]) { rowmin[y] = L3; }
+                    continue;
+                }
+                if (type == 0) {
+                    if ((L2 >= 0) || (L3 >= 0)) { continue; }
+                    L3M = (L3 >= m) ? m : L3;
+                    a2 = (float)fabs(L2); d = (float)fabs(L3M - L2);
+                    r = (a2*a2*d)*27/((2*a2 + d)*(2*a2 + d)*(2*a2 + d));
+                    if (L2 < L3M/2) { r = 1; }
+                } else {
+                    if ((L1 >= 0) || (L2 >= 0) || (L3 >= 0)) { continue; }
+                    L3M = (L3 >= m) ? m : L3;
+                    r = ((L1*L1)*L3M*27)/((2*L1 + L3M)*(2*L1 + L3M)*(2*L1 + L3M));
+                    if (fabs(L1) > fabs(L3M)) { r = 1; }
+                }
+                r = finite_or_zero(r);
+                if (r > R[i + z*nxy]) { R[i + z*nxy] = r; }
+            }
+        }
+        if (pass == 0) {
+            for (y = 0; y < ny; y++) { if (rowmin[y] < result) { result = rowmin[y]; } }
+        }
+    }
+    mxFree(rowmin);
+    return result;
+}
+
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
+    JermanContext ctx;
+    const mwSize *idims;
+    const double *sigmas, *spacing;
+    double tau, mx;
+    float *R, lmin;
+    int whiteondark = 1, type = 0, j, k;
+    mwSignedIndex nsigmas, npixels, i;
+
+    /* Check for proper number of arguments. */
+    if((nrhs<4)||(nrhs>6)) {
+        mexErrMsgTxt("Four to six inputs are required.");
+    }
+    ctx.cls = mxGetClassID(prhs[0]);
+    if((ctx.cls!=mxDOUBLE_CLASS)&&(ctx.cls!=mxSINGLE_CLASS)&&(ctx.cls!=mxUINT8_CLASS)&&(ctx.cls!=mxUINT16_CLASS)) {
+        mexErrMsgTxt("I must be double, single, uint8 or uint16.");
+    }
+    if(mxGetNumberOfDimensions(prhs[0])!=3) {
+        mexErrMsgTxt("I must be a 3D volume.");
+    }
+    idims = mxGetDimensions(prhs[0]);
+    if((idims[0]<2)||(idims[1]<2)||(idims[2]<2)) {
+        mexErrMsgTxt("I must have at least 2 voxels along each dimension.");
+    }
+    if(!mxIsDouble(prhs[1])||!mxIsDouble(prhs[2])||(mxGetNumberOfElements(prhs[2])!=3)) {
+        mexErrMsgTxt("sigmas must be double, spacing must be 3 doubles.");
+    }
+    if(nrhs>4) { whiteondark = (mxGetScalar(prhs[4])!=0); }
+    if(nrhs>5) { type = (int)mxGetScalar(prhs[5]); }
+    if((type!=0)&&(type!=1)) {
+        mexErrMsgTxt("Type must be 0 (vesselness) or 1 (blobness).");
+    }
+    sigmas = mxGetPr(prhs[1]);
+    spacing = mxGetPr(prhs[2]);
+    nsigmas = mxGetNumberOfElements(prhs[1]);
+    tau = mxGetScalar(prhs[3]);
+
+    ctx.data = mxGetData(prhs[0]);
+    ctx.nx = idims[0]; ctx.ny = idims[1]; ctx.nz = idims[2];
+    ctx.nxy = ctx.nx*ctx.ny;
+    npixels = ctx.nxy*ctx.nz;
+    ctx.tmp = (float *)mxMalloc(ctx.nxy*sizeof(float));
+    ctx.tmp2 = (float *)mxMalloc(ctx.nxy*sizeof(float));
+    for(k=0; k<3; k++) {
+        ctx.F[k] = (float *)mxMalloc(ctx.nxy*sizeof(float));
+        for(j=0; j<3; j++) { ctx.D[j][k] = (float *)mxMalloc(ctx.nxy*sizeof(float)); }
+    }
+
+    plhs[0] = mxCreateNumericArray(3, idims, mxSINGLE_CLASS, mxREAL);
+    R = (float *)mxGetData(plhs[0]);
+
+    for(i=0; i<nsigmas; i++) {
+        mexPrintf("Current Filter Sigma: %g\n", sigmas[i]);
+        ctx.hx = ctx.hy = ctx.hz = NULL;
+        if(sigmas[i]>0) {
+            ctx.hx = gaussian_kernel(sigmas[i], spacing[0], &ctx.rx);
+            ctx.hy = gaussian_kernel(sigmas[i], spacing[1], &ctx.ry);
+            ctx.hz = gaussian_kernel(sigmas[i], spacing[2], &ctx.rz);
+        }
+        lmin = sweep(&ctx, sigmas[i], whiteondark, type, 0, 0.0f, tau, R);
+        sweep(&ctx, sigmas[i], whiteondark, type, 1, lmin, tau, R);
+        if(sigmas[i]>0) { mxFree(ctx.hx); mxFree(ctx.hy); mxFree(ctx.hz); }
+    }
+
+    /* Normalization */
+    mx = 0;
+    for(i=0; i<npixels; i++) { if(R[i]>mx) { mx = R[i]; } }
+    for(i=0; i<npixels; i++) {
+        R[i] = R[i]/(float)mx;
+        if(R[i]<1e-2f) { R[i] = 0; }
+    }
+
+    mxFree(ctx.tmp); mxFree(ctx.tmp2);
+    for(k=0; k<3; k++) {
+        mxFree(ctx.F[k]);
+        for(j=0; j<3; j++) { mxFree(ctx.D[j][k]); }
+    }
+}
@@ -0,0 +1,87 @@
+function test_eig3volume(N)
+
+% Compare the two solvers of eig3volume (compile eig3volume.c first):
+% mode 0 (JAMA Householder + QL iterations) and mode 1 (closed form) on
+% random, diagonal, rank-one and near double root symmetric matrices, in
+% double and single precision. Errors out on the first failed check.
+%
+% N (optional): number of matrices per case, default 10000
+
+if nargin < 1
+    N = 10000;
+end
+if exist('eig3volume','file') ~= 3
+    error('eig3volume MEX file not found, run compile first');
+end
+
+rng(0);
+Cases = {'random','diagonal','rank-one','near double root'};
+Classes = {'double','single'};
+% Tolerances relative to sum(abs(eigenvalues)): eigenvalues, 1-|v0.v1| for
+% well separated Lambda1, residual norm(H*v1-Lambda1*v1)
+Tols = [1e-10 1e-8 1e-10; 1e-5 1e-5 1e-5];
+
+for c = 1:numel(Cases)
+    H = make_matrices(Cases{c}, N);
+    for k = 1:numel(Classes)
+        Hc = cast(H, Classes{k});
+        Tol = Tols(k,:);
+        [L01,L02,L03,V0x,V0y,V0z] = eig3volume(Hc(:,1),Hc(:,2),Hc(:,3),Hc(:,4),Hc(:,5),Hc(:,6),0);
+        [L11,L12,L13,V1x,V1y,V1z] = eig3volume(Hc(:,1),Hc(:,2),Hc(:,3),Hc(:,4),Hc(:,5),Hc(:,6),1);
+        assert(isa(L11,Classes{k}) && isa(V1x,Classes{k}), 'eig3volume: output class differs from input class');
+        L0 = double([L01 L02 L03]); L1 = double([L11 L12 L13]);
+        V0 = double([V0x V0y V0z]); V1 = double([V1x V1y V1z]);
+        Scale = max(sum(abs(L0),2), realmin);
+
+        %% Eigenvalues (increasing absolute value)
+        ErrL = max(abs(L0-L1),[],2)./Scale;
+        assert(max(ErrL) <= Tol(1), sprintf('%s %s: eigenvalues differ by %g', Cases{c}, Classes{k}, max(ErrL)));
+        assert(all(all(abs(L1(:,1:2)) <= abs(L1(:,2:3))*(1+Tol(1)) + Tol(1)*[Scale Scale])), ...
+            sprintf('%s %s: eigenvalues not sorted by absolute value', Cases{c}, Classes{k}));
+
+        %% Eigenvector of Lambda1, up to sign where Lambda1 is well separated
+        Sep = abs(abs(L0(:,2))-abs(L0(:,1)))./Scale > 1e-3;
+        ErrV = 1-abs(sum(V0.*V1,2));
+        if any(Sep)
+            assert(max(ErrV(Sep)) <= Tol(2), sprintf('%s %s: eigenvectors differ by %g', Cases{c}, Classes{k}, max(ErrV(Sep))));
+        end
+        assert(max(abs(sqrt(sum(V1.^2,2))-1)) <= Tol(2), sprintf('%s %s: eigenvectors not normalized', Cases{c}, Classes{k}));
+        Hd = double(Hc);
+        HV = [Hd(:,1).*V1(:,1)+Hd(:,2).*V1(:,2)+Hd(:,3).*V1(:,3), ...
+              Hd(:,2).*V1(:,1)+Hd(:,4).*V1(:,2)+Hd(:,5).*V1(:,3), ...
+              Hd(:,3).*V1(:,1)+Hd(:,5).*V1(:,2)+Hd(:,6).*V1(:,3)];
+        Res = sqrt(sum((HV-repmat(L1(:,1),1,3).*V1).^2,2))./Scale;
+        assert(max(Res) <= Tol(3), sprintf('%s %s: eigenvector residual %g', Cases{c}, Classes{k}, max(Res)));
+
+        disp(sprintf('%-17s %-7s eigenvalues %8.2g  eigenvectors %8.2g  residual %8.2g', Cases{c}, Classes{k}, max(ErrL), max([ErrV(Sep); 0]), max(Res)));
+    end
+end
+disp('eig3volume: mode 0 and mode 1 agree');
+
+end
+
+% N x 6 matrix of the upper triangles [Dxx Dxy Dxz Dyy Dyz Dzz]
+function H = make_matrices(Case, N)
+
+H = zeros(N,6);
+switch Case
+    case 'random'
+        H = 2*rand(N,6)-1;
+    case 'diagonal'
+        H(:,[1 4 6]) = 2*rand(N,3)-1;
+    otherwise
+        for i = 1:N
+            [Q,R] = qr(randn(3));
+            if strcmp(Case,'rank-one')
+                L = [4*rand-2 0 0];
+            else
+                % two eigenvalues equal up to a relative 1e-7
+                L = 2*rand(1,2)-1;
+                L = [L(1) L(2) L(2)*(1+1e-7*(2*rand-1))];
+            end
+            M = Q*diag(L(randperm(3)))*Q';
+            H(i,:) = [M(1,1) M(1,2) M(1,3) M(2,2) M(2,3) M(3,3)];
+        end
+end
+
+end
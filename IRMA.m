@@ -693,7 +693,11 @@ function [ReportFolder ExportMeshFolder] = IRMA(varargin)
                 
                 %% Re-analyze skeleton (note: isolated loops are ignored)
                 % link nodes indexed as double, should be fine for brick skeleton
-                [~, node, link] = Skel2Graph3D(S,0);
+                if exist('skeletongraph','file')==3
+                    [~, node, link] = skeletongraph(S,0);
+                else
+                    [~, node, link] = Skel2Graph3D(S,0);
+                end
                 
                 %% Compute total skeleton length
                 totBrcLgth = 0;
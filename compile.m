@@ -25,20 +25,21 @@ try
         case 'Yes'
             cd('.\Code\_Utils');
             FilesToCompile = dir('*.cpp');
+            OpenMPFiles = {'LocMax3D_thr.cpp','LoG3DLocMax3D.cpp','Propagate_3D_single.cpp','PropagateRegIntegrate.cpp'};
             for i = 1:length(FilesToCompile)    
                 switch FilesToCompile(i).name
-                    case 'LocMax3D_thr.cpp'
+                    case OpenMPFiles
                         if ispc
-                            disp('Compiling LocMax3D_thr.cpp');
-                            mex -v COMPFLAGS="$COMPFLAGS /openmp" LocMax3D_thr.cpp
+                            disp(['Compiling ' FilesToCompile(i).name]);
+                            mex('-v','COMPFLAGS=$COMPFLAGS /openmp',FilesToCompile(i).name);
                         end
                         if isunix
-                            disp('Compiling LocMax3D_thr.cpp');
-                            mex -v CFLAGS='$CFLAGS -fopenmp' -LDFLAGS='$LDFLAGS -fopenmp' LocMax3D_thr.cpp
+                            disp(['Compiling ' FilesToCompile(i).name]);
+                            mex('-v','CXXFLAGS=$CXXFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp',FilesToCompile(i).name);
                         end
                         if ismac
-                            disp('Compiling LocMax3D_thr.cpp');
-                            mex -v CFLAGS='$CFLAGS -fopenmp' -LDFLAGS='$LDFLAGS -fopenmp' LocMax3D_thr.cpp
+                            disp(['Compiling ' FilesToCompile(i).name]);
+                            mex('-v','CXXFLAGS=$CXXFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp',FilesToCompile(i).name);
                         end
                     otherwise
                         disp(['Compiling' FilesToCompile(i).name]);
@@ -48,11 +49,45 @@ try
             cd(CurrentPath);
             cd('.\Code\_Utils\BIF');
             disp('compiling oBIFsQuantization');
-            mex oBIFsQuantization.cpp
+            if ispc
+                mex('-v','COMPFLAGS=$COMPFLAGS /openmp','oBIFsQuantization.cpp');
+            else
+                mex('-v','CXXFLAGS=$CXXFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp','oBIFsQuantization.cpp');
+            end
+            cd(CurrentPath);
+            cd('.\Code\_Utils\vesselness_blobness');
+            disp('compiling eig3volume, eig3masked and jermanfilter3D');
+            VesselnessFiles = {'eig3volume.c','eig3masked.c','jermanfilter3D.c'};
+            for i = 1:length(VesselnessFiles)
+                if ispc
+                    mex('-v','COMPFLAGS=$COMPFLAGS /openmp',VesselnessFiles{i});
+                else
+                    mex('-v','CFLAGS=$CFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp',VesselnessFiles{i});
+                end
+            end
             cd(CurrentPath);
             cd('.\Code\_Utils\shortestpath');
-            disp('compiling rk4');
+            disp('compiling rk4, rk4paths and geodesicdistance');
             mex rk4.c
+            mex geodesicdistance.cpp
+            if ispc
+                mex('-v','COMPFLAGS=$COMPFLAGS /openmp','rk4paths.cpp');
+            else
+                mex('-v','CXXFLAGS=$CXXFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp','rk4paths.cpp');
+            end
+            cd(CurrentPath);
+            cd('.\Code\_Utils\isthmus_thinning');
+            disp('compiling isthmusthinning');
+            mex isthmusthinning_inplace.c
+            mex skeletongraph.c
+            ThinningFiles = {'isthmusthinning.c','isthmusthinning_batch.c'};
+            for i = 1:length(ThinningFiles)
+                if ispc
+                    mex('-v','COMPFLAGS=$COMPFLAGS /openmp',ThinningFiles{i});
+                else
+                    mex('-v','CFLAGS=$CFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp',ThinningFiles{i});
+                end
+            end
             cd(CurrentPath);
             cd('.\Tools\LOBSTER_Annotator\functions\RF\Random_Forests\cartree\mx_files');
             disp('Compiling RF');